@@ -0,0 +1,139 @@
+// Compare base64 implementations on multi-megabyte bodies, like images that
+// theme plugins fetch with `binary: true`, and the resolve payload built
+// from them.
+#include "base64.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <random>
+
+// base64() before vectorization, appending a char at a time.
+static std::string old_base64(const std::string &s) {
+    static const char *chars =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string ret;
+    ret.reserve((s.size() + 2) / 3 * 4);
+    unsigned int w = 0;
+    int b = -6;
+    for (unsigned char c : s) {
+        w = (w << 8) + c;
+        b += 8;
+        while (b >= 0) {
+            ret += chars[(w >> b) & 0x3F];
+            b -= 6;
+        }
+    }
+    if (b > -6)
+        ret += chars[((w << 8) >> (b + 8)) & 0x3F];
+    while (ret.size() % 4)
+        ret += '=';
+    return ret;
+}
+
+template <typename F> static double measure_ms(int iterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static bool check(size_t size, std::mt19937 &rng) {
+    std::string data(size, '\0');
+    for (auto &c : data) {
+        c = static_cast<char>(rng());
+    }
+    std::string fast, scalar, decoded, decoded_scalar;
+    base64_encode(data, fast);
+    base64_encode_scalar(data, scalar);
+    if (fast != old_base64(data) || scalar != fast) {
+        std::cerr << "Encoding mismatch at size " << size << std::endl;
+        return false;
+    }
+    if (!base64_decode(fast, decoded) || decoded != data ||
+        !base64_decode_scalar(fast, decoded_scalar) || decoded_scalar != data) {
+        std::cerr << "Decoding mismatch at size " << size << std::endl;
+        return false;
+    }
+    // Without padding.
+    decoded.clear();
+    if (!base64_decode(fast.substr(0, fast.find('=')), decoded) ||
+        decoded != data) {
+        std::cerr << "Unpadded decoding mismatch at size " << size
+                  << std::endl;
+        return false;
+    }
+    // A bad char anywhere, including inside vectorized blocks.
+    if (size_t unpadded = std::min(fast.find('='), fast.size())) {
+        std::string bad = fast;
+        bad[rng() % unpadded] = '*';
+        decoded.clear();
+        if (base64_decode(bad, decoded)) {
+            std::cerr << "Invalid input accepted at size " << size
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = (argc > 1 ? std::stoul(argv[1]) : 4) << 20;
+    int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+    std::mt19937 rng(42);
+    for (size_t n = 0; n < 200; ++n) {
+        if (!check(n, rng)) {
+            return 1;
+        }
+    }
+    if (!check(size + 1, rng)) {
+        return 1;
+    }
+
+    std::string data(size, '\0');
+    for (auto &c : data) {
+        c = static_cast<char>(rng());
+    }
+    std::string encoded;
+    base64_encode(data, encoded);
+    std::string out;
+    auto old_encode = measure_ms(iterations, [&] { out = old_base64(data); });
+    auto scalar_encode = measure_ms(iterations, [&] {
+        out.clear();
+        base64_encode_scalar(data, out);
+    });
+    auto encode = measure_ms(iterations, [&] {
+        out.clear();
+        base64_encode(data, out);
+    });
+    auto scalar_decode = measure_ms(iterations, [&] {
+        out.clear();
+        base64_decode_scalar(encoded, out);
+    });
+    auto decode = measure_ms(iterations, [&] {
+        out.clear();
+        base64_decode(encoded, out);
+    });
+    // Payload of a binary curl response, before and after.
+    auto old_payload = measure_ms(iterations, [&] {
+        nlohmann::json j{{"status", 200}, {"data", old_base64(data)}};
+        out = j.dump();
+    });
+    auto payload = measure_ms(iterations, [&] {
+        out = "{\"status\":200,\"data\":\"";
+        base64_encode(data, out);
+        out += "\"}";
+    });
+
+    std::cout << (size >> 20) << " MiB, " << base64_isa() << ":\n"
+              << "encode: old " << old_encode << " ms, scalar "
+              << scalar_encode << " ms, vectorized " << encode << " ms\n"
+              << "decode: scalar " << scalar_decode << " ms, vectorized "
+              << decode << " ms\n"
+              << "payload: json " << old_payload << " ms, direct " << payload
+              << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Drive WebviewCandidateWindow through a StubBridge, so that the state
+// machine, serialization and dispatch are measured without a display or a
+// WebKit process. Inputs are fixed, so counts of evals and bytes are
+// reproducible across runs.
+#include "webview_candidate_window.hpp"
+#include <chrono>
+#include <iostream>
+
+using namespace candidate_window;
+
+static const char *texts[] = {"输入法", "输入", "书",   "属于", "数字",
+                              "😄",     "树木", "殊途", "舒适", "叔叔"};
+
+static std::vector<Candidate> make_candidates(int page) {
+    std::vector<Candidate> candidates;
+    for (int i = 0; i < 10; ++i) {
+        candidates.push_back({texts[(i + page) % 10],
+                              std::to_string((i + 1) % 10),
+                              page % 2 ? "shū" : "",
+                              {}});
+    }
+    return candidates;
+}
+
+template <typename F> static double measure(int iterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+    auto bridge = std::make_unique<StubBridge>();
+    StubBridge *stub = bridge.get();
+    stub->record_evals = false;
+    WebviewCandidateWindow window(std::move(bridge), [] {});
+    window.set_highlight_callback([](int) {});
+    stub->call("fcitx", R"(["onload"])");
+
+    auto report = [&](const char *name, double ns) {
+        auto stats = window.bridge_stats();
+        std::cout << name << ns << " ns/op, " << stats.evals << " evals, "
+                  << stats.bytes << " bytes" << std::endl;
+        window.reset_bridge_stats();
+    };
+
+    std::vector<std::vector<Candidate>> pages{make_candidates(0),
+                                              make_candidates(1)};
+    const char *preedits[] = {"s", "sh", "shu", "shur", "shuru"};
+
+    window.reset_bridge_stats();
+    report("update_input_panel: ", measure(iterations, [&](int i) {
+               window.update_input_panel({{preedits[i % 5], 0}}, i % 5 + 1,
+                                         {}, {});
+               stub->run_pending();
+           }));
+    report("set_candidates:     ", measure(iterations, [&](int i) {
+               window.set_candidates(pages[i % 2], 0, scroll_state_t::none,
+                                     false, false);
+               stub->run_pending();
+           }));
+    report("show:               ", measure(iterations, [&](int) {
+               window.show(100, 200, 18);
+           }));
+    // A keystroke: new preedit and candidates, then show.
+    report("keystroke:          ", measure(iterations, [&](int i) {
+               window.update_input_panel({{preedits[i % 5], 0}}, i % 5 + 1,
+                                         {}, {});
+               window.set_candidates(pages[i % 2], i % 3, scroll_state_t::none,
+                                     false, false);
+               stub->run_pending();
+               window.show(100, 200, 18);
+           }));
+
+    const char *resize =
+        R"(["resize",0,0,0,12.5,240.25,40.5,10.5,10.5,240.25,40.5,10.5,6,6,)"
+        R"(6,6,1,260.75,60.5,false])";
+    report("call_handler:       ", measure(iterations, [&](int i) {
+               stub->call("fcitx", i % 2 ? resize : R"(["highlight",3])");
+           }));
+    return 0;
+}
@@ -0,0 +1,202 @@
+// Hammer CurlMultiManager from many threads at once: each adds requests to
+// a local HTTP server and cancels some of them, while a slow main loop runs
+// the callbacks. Every request must be called back exactly once on the main
+// loop, no request state may leak, and submitters must not wait for the
+// worker or the callbacks.
+#include "curl.hpp"
+#include "local_server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+// Stands in for the GTK main loop that WebviewCandidateWindow posts to.
+class MainLoop {
+  public:
+    MainLoop() : thread_([this] { run(); }) {}
+    ~MainLoop() {
+        post(nullptr);
+        thread_.join();
+    }
+    void post(std::function<void()> task) {
+        std::lock_guard g(m_);
+        tasks_.push_back(std::move(task));
+        cv_.notify_one();
+    }
+    std::thread::id id() const { return thread_.get_id(); }
+
+  private:
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::thread thread_;
+
+    void run() {
+        while (true) {
+            std::unique_lock lock(m_);
+            cv_.wait(lock, [this] { return !tasks_.empty(); });
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            if (!task) {
+                return;
+            }
+            task();
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    int producers = argc > 1 ? std::stoi(argv[1]) : 8;
+    int per_producer = argc > 2 ? std::stoi(argv[2]) : 250;
+    size_t total = static_cast<size_t>(producers) * per_producer;
+    signal(SIGPIPE, SIG_IGN);
+    auto base = "http://127.0.0.1:" + std::to_string(start_server());
+    bool ok = true;
+
+    {
+        CurlMultiManager manager;
+        MainLoop loop;
+        manager.set_dispatch(
+            [&loop](std::function<void()> f) { loop.post(std::move(f)); });
+
+        auto calls = std::make_unique<std::atomic<int>[]>(total);
+        std::atomic<size_t> done = 0, cancelled = 0, wrong_thread = 0,
+                            wrong_data = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<double> add_us(total);
+
+        auto start = steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                std::mt19937 rng(p);
+                for (int i = 0; i < per_producer; ++i) {
+                    size_t n = static_cast<size_t>(p) * per_producer + i;
+                    // Some requests are slow so that cancelling them is
+                    // likely to find them in flight.
+                    auto url = rng() % 4 ? base + "/echo/" + std::to_string(n)
+                                         : base + "/delay/20";
+                    CURL *easy = manager.acquire();
+                    curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+                    auto t0 = steady_clock::now();
+                    auto id = manager.add(
+                        easy, [&, n, url](CURLcode res, CURL *,
+                                          const std::string &data) {
+                            calls[n]++;
+                            if (std::this_thread::get_id() != loop.id()) {
+                                wrong_thread++;
+                            }
+                            if (res == CURLE_ABORTED_BY_CALLBACK) {
+                                cancelled++;
+                            } else if (res != CURLE_OK ||
+                                       (url.find("/echo/") !=
+                                            std::string::npos &&
+                                        data != std::to_string(n))) {
+                                wrong_data++;
+                            }
+                            // A main loop busy with rendering.
+                            std::this_thread::sleep_for(microseconds(100));
+                            if (++done == total) {
+                                std::lock_guard g(mutex);
+                                cv.notify_one();
+                            }
+                        });
+                    add_us[n] = duration<double, std::micro>(
+                                    steady_clock::now() - t0)
+                                    .count();
+                    if (rng() % 3 == 0) {
+                        if (rng() % 2) {
+                            std::this_thread::sleep_for(microseconds(500));
+                        }
+                        manager.cancel(id);
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        auto submitted = steady_clock::now();
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [&] { return done == total; });
+        }
+        auto finished = steady_clock::now();
+
+        size_t duplicated = 0;
+        for (size_t n = 0; n < total; ++n) {
+            duplicated += calls[n] != 1;
+        }
+        std::sort(add_us.begin(), add_us.end());
+        std::cout << producers << " threads x " << per_producer
+                  << " requests: submitted in "
+                  << duration_cast<milliseconds>(submitted - start).count()
+                  << " ms, called back in "
+                  << duration_cast<milliseconds>(finished - start).count()
+                  << " ms, " << cancelled << " cancelled\n"
+                  << "add(): median " << add_us[total / 2] << " us, p99 "
+                  << add_us[total * 99 / 100] << " us, max " << add_us.back()
+                  << " us" << std::endl;
+        if (duplicated || wrong_thread || wrong_data) {
+            std::cerr << duplicated << " requests not called back once, "
+                      << wrong_thread << " off main loop, " << wrong_data
+                      << " failed" << std::endl;
+            ok = false;
+        }
+        // The last callback has returned, but its state may still be being
+        // released on the main loop.
+        std::promise<void> idle;
+        loop.post([&] { idle.set_value(); });
+        idle.get_future().wait();
+        if (manager.live_requests() != 0) {
+            std::cerr << manager.live_requests() << " requests leaked"
+                      << std::endl;
+            ok = false;
+        }
+        // Callbacks alone take total * 100 us on the main loop. Submitting
+        // must not have waited for them.
+        if (submitted - start >= microseconds(100) * total) {
+            std::cerr << "Submitters were held up by callbacks" << std::endl;
+            ok = false;
+        }
+    }
+
+    // Destroying a manager with requests in flight or queued drops them
+    // without calling back.
+    {
+        std::atomic<int> called = 0;
+        {
+            CurlMultiManager manager;
+            for (int i = 0; i < 50; ++i) {
+                CURL *easy = curl_easy_init();
+                curl_easy_setopt(easy, CURLOPT_URL,
+                                 (base + "/delay/1000").c_str());
+                manager.add(easy, [&](CURLcode, CURL *, const std::string &) {
+                    called++;
+                });
+            }
+            std::this_thread::sleep_for(milliseconds(50));
+        }
+        std::cout << "destroyed with 50 in flight: " << called
+                  << " called back" << std::endl;
+        if (called) {
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
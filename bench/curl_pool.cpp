@@ -0,0 +1,81 @@
+// Median latency of repeated requests to one TLS server, with a fresh easy
+// handle per request versus CurlMultiManager's pooled handles and shared
+// caches. For a local server with a self-signed certificate:
+//   openssl req -x509 -nodes -subj /CN=localhost -keyout key.pem -out cert.pem
+//   openssl s_server -accept 8443 -cert cert.pem -key key.pem -WWW
+//   curl_pool_bench https://localhost:8443/cert.pem
+#include "curl.hpp"
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+
+using namespace std::chrono;
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+// Certificate of a local test server is self-signed.
+static void setup(CURL *easy, const std::string &url) {
+    curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, 0L);
+}
+
+static size_t discard(char *, size_t size, size_t nmemb, void *) {
+    return size * nmemb;
+}
+
+int main(int argc, char *argv[]) {
+    std::string url = argc > 1 ? argv[1] : "https://localhost:8443/cert.pem";
+    int iterations = argc > 2 ? std::stoi(argv[2]) : 50;
+    auto &manager = CurlMultiManager::shared();
+
+    std::vector<double> fresh;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = steady_clock::now();
+        CURL *easy = curl_easy_init();
+        setup(easy, url);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, discard);
+        CURLcode res = curl_easy_perform(easy);
+        curl_easy_cleanup(easy);
+        if (res != CURLE_OK) {
+            std::cerr << curl_easy_strerror(res) << std::endl;
+            return 1;
+        }
+        fresh.push_back(duration<double, std::milli>(steady_clock::now() -
+                                                     start)
+                            .count());
+    }
+
+    std::vector<double> pooled;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = steady_clock::now();
+        CURL *easy = manager.acquire();
+        setup(easy, url);
+        std::promise<CURLcode> done;
+        manager.add(easy, [&](CURLcode res, CURL *, const std::string &) {
+            done.set_value(res);
+        });
+        CURLcode res = done.get_future().get();
+        if (res != CURLE_OK) {
+            std::cerr << curl_easy_strerror(res) << std::endl;
+            return 1;
+        }
+        pooled.push_back(duration<double, std::milli>(steady_clock::now() -
+                                                      start)
+                             .count());
+    }
+
+    auto stats = manager.pool_stats();
+    std::cout << "fresh handle:  " << median(fresh) << " ms median" << std::endl
+              << "pooled handle: " << median(pooled) << " ms median"
+              << std::endl
+              << "reuse ratio " << stats.reuse_ratio() << ", "
+              << stats.connections_reused << "/" << stats.transfers
+              << " connections reused, " << stats.handshakes_avoided
+              << " TLS handshakes avoided" << std::endl;
+    return 0;
+}
@@ -0,0 +1,332 @@
+// Run CurlMultiManager against a local HTTP server: many concurrent
+// requests, timeout accuracy, cancellation, bounded streaming, and no
+// wakeups of the worker while idle.
+#include "curl.hpp"
+#include "local_server.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <signal.h>
+#include <string>
+#include <thread>
+
+using namespace std::chrono;
+
+struct Result {
+    CURLcode code;
+    long status;
+    std::string data;
+    steady_clock::time_point end;
+};
+
+// Issue requests for urls concurrently and wait for all of them.
+static std::vector<Result> fetch_all(const std::vector<std::string> &urls,
+                                     long timeout_ms = 0) {
+    std::vector<Result> results(urls.size());
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done = 0;
+    for (size_t i = 0; i < urls.size(); ++i) {
+        CURL *easy = curl_easy_init();
+        curl_easy_setopt(easy, CURLOPT_URL, urls[i].c_str());
+        if (timeout_ms) {
+            curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeout_ms);
+        }
+        CurlMultiManager::shared().add(
+            easy, [&, i](CURLcode res, CURL *curl, const std::string &data) {
+                long status = 0;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                std::lock_guard lock(mutex);
+                results[i] = {res, status, data, steady_clock::now()};
+                if (++done == urls.size()) {
+                    cv.notify_one();
+                }
+            });
+    }
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&] { return done == urls.size(); });
+    return results;
+}
+
+#ifdef __linux__
+// Context switches of all threads of this process.
+static long context_switches() {
+    long total = 0;
+    DIR *dir = opendir("/proc/self/task");
+    while (auto entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::ifstream status(std::string("/proc/self/task/") + entry->d_name +
+                             "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.find("ctxt_switches:") != std::string::npos) {
+                total += std::stol(line.substr(line.find(':') + 1));
+            }
+        }
+    }
+    closedir(dir);
+    return total;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    int concurrency = argc > 1 ? std::stoi(argv[1]) : 300;
+    // Server writes to connections that timed out.
+    signal(SIGPIPE, SIG_IGN);
+    auto base = "http://127.0.0.1:" + std::to_string(start_server());
+    bool ok = true;
+
+    std::vector<std::string> urls;
+    for (int i = 0; i < concurrency; ++i) {
+        urls.push_back(base + "/echo/" + std::to_string(i));
+    }
+    auto start = steady_clock::now();
+    auto results = fetch_all(urls);
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+    for (int i = 0; i < concurrency; ++i) {
+        if (results[i].code != CURLE_OK || results[i].status != 200 ||
+            results[i].data != std::to_string(i)) {
+            std::cerr << "Request " << i << " failed: "
+                      << curl_easy_strerror(results[i].code) << std::endl;
+            ok = false;
+        }
+    }
+    std::cout << concurrency << " concurrent requests: " << elapsed.count()
+              << " ms" << std::endl;
+
+    for (long timeout : {30, 120, 275}) {
+        start = steady_clock::now();
+        auto result = fetch_all({base + "/delay/400"}, timeout)[0];
+        auto ms = duration_cast<milliseconds>(result.end - start).count();
+        std::cout << "timeout " << timeout << " ms: fired after " << ms
+                  << " ms" << std::endl;
+        // The old 50 ms polling could overshoot by up to 50 ms.
+        if (result.code != CURLE_OPERATION_TIMEDOUT || ms < timeout ||
+            ms > timeout + 20) {
+            ok = false;
+        }
+    }
+
+    // Cancel slow requests right away (likely before the worker adds them)
+    // and after they are sent. Each must call back promptly with an abort.
+    for (long after : {0, 50}) {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::optional<CURLcode> code;
+        CURL *easy = curl_easy_init();
+        curl_easy_setopt(easy, CURLOPT_URL, (base + "/delay/1000").c_str());
+        start = steady_clock::now();
+        auto id = CurlMultiManager::shared().add(
+            easy, [&](CURLcode res, CURL *, const std::string &) {
+                std::lock_guard lock(mutex);
+                code = res;
+                cv.notify_one();
+            });
+        std::this_thread::sleep_for(milliseconds(after));
+        CurlMultiManager::shared().cancel(id);
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return code.has_value(); });
+        lock.unlock();
+        auto ms = duration_cast<milliseconds>(steady_clock::now() - start);
+        std::cout << "cancel after " << after << " ms: called back after "
+                  << ms.count() << " ms" << std::endl;
+        if (*code != CURLE_ABORTED_BY_CALLBACK || ms.count() > after + 20) {
+            ok = false;
+        }
+        // Cancelling a finished transfer does nothing.
+        CurlMultiManager::shared().cancel(id);
+    }
+
+    // Queue more bulk requests than may run at once, after which an
+    // interactive one must go first, and bulk ones must respect the limit.
+    {
+        constexpr int kBulk = 16;
+        std::mutex mutex;
+        std::condition_variable cv;
+        int bulk_done = 0;
+        std::optional<steady_clock::time_point> interactive_done;
+        for (int i = 0; i < kBulk; ++i) {
+            CURL *easy = curl_easy_init();
+            curl_easy_setopt(easy, CURLOPT_URL, (base + "/delay/50").c_str());
+            CurlMultiManager::shared().add(
+                easy,
+                [&](CURLcode, CURL *, const std::string &) {
+                    std::lock_guard lock(mutex);
+                    ++bulk_done;
+                    cv.notify_one();
+                },
+                nullptr, CurlPriority::kBulk);
+        }
+        CURL *easy = curl_easy_init();
+        curl_easy_setopt(easy, CURLOPT_URL, (base + "/echo/now").c_str());
+        start = steady_clock::now();
+        CurlMultiManager::shared().add(
+            easy,
+            [&](CURLcode, CURL *, const std::string &) {
+                std::lock_guard lock(mutex);
+                interactive_done = steady_clock::now();
+                cv.notify_one();
+            },
+            nullptr, CurlPriority::kInteractive);
+        std::unique_lock lock(mutex);
+        cv.wait(lock,
+                [&] { return interactive_done && bulk_done == kBulk; });
+        lock.unlock();
+        auto bulk_ms = duration_cast<milliseconds>(steady_clock::now() - start);
+        auto ms = duration_cast<milliseconds>(*interactive_done - start);
+        auto stats = CurlMultiManager::shared().queue_stats();
+        std::cout << "interactive behind " << kBulk << " bulk: " << ms.count()
+                  << " ms, bulk " << bulk_ms.count() << " ms\n";
+        const char *names[] = {"interactive", "normal", "bulk"};
+        for (size_t p = 0; p < kCurlPriorities; ++p) {
+            std::cout << "  " << names[p] << " queued " << stats[p].admitted
+                      << ", mean " << stats[p].mean_ms() << " ms, max "
+                      << stats[p].max_ms << " ms\n";
+        }
+        std::cout << std::flush;
+        // 4 bulk at a time take 4 rounds of 50 ms.
+        auto rounds = (kBulk + 3) / 4;
+        if (ms.count() > 20 || bulk_ms.count() < rounds * 50 ||
+            stats[2].max_ms < (rounds - 1) * 50) {
+            ok = false;
+        }
+    }
+
+    // Stream a large body to a slow consumer, which must bound what's held
+    // in memory by pausing the transfer.
+    {
+        constexpr size_t kTotal = 16 << 20, kWindow = 256 << 10;
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t held = 0, max_held = 0, received = 0;
+        bool paused = false, finished = false;
+        CURLcode code = CURLE_OK;
+        CURL *easy = curl_easy_init();
+        curl_easy_setopt(easy, CURLOPT_URL,
+                         (base + "/bytes/" + std::to_string(kTotal)).c_str());
+        auto id = CurlMultiManager::shared().add(
+            easy,
+            [&](CURLcode res, CURL *, const std::string &) {
+                std::lock_guard lock(mutex);
+                code = res;
+                finished = true;
+                cv.notify_one();
+            },
+            [&](const char *, size_t size) -> size_t {
+                std::lock_guard lock(mutex);
+                if (held >= kWindow) {
+                    paused = true;
+                    return CURL_WRITEFUNC_PAUSE;
+                }
+                held += size;
+                received += size;
+                max_held = std::max(max_held, held);
+                cv.notify_one();
+                return size;
+            });
+        start = steady_clock::now();
+        int pauses = 0;
+        std::unique_lock lock(mutex);
+        while (true) {
+            cv.wait(lock, [&] { return finished || held > 0; });
+            if (finished) {
+                break;
+            }
+            // Consume 64 KiB per ms, slower than loopback.
+            held -= std::min<size_t>(held, 64 << 10);
+            bool resume = paused && held <= kWindow / 2;
+            if (resume) {
+                paused = false;
+                ++pauses;
+            }
+            // Callbacks of CurlMultiManager take mutex, so don't hold it.
+            lock.unlock();
+            if (resume) {
+                CurlMultiManager::shared().resume(id);
+            }
+            std::this_thread::sleep_for(milliseconds(1));
+            lock.lock();
+        }
+        auto ms = duration_cast<milliseconds>(steady_clock::now() - start);
+        std::cout << "stream " << (kTotal >> 20) << " MiB: " << ms.count()
+                  << " ms, " << pauses << " pauses, at most "
+                  << (max_held >> 10) << " KiB held" << std::endl;
+        if (code != CURLE_OK || received != kTotal ||
+            max_held > kWindow + CURL_MAX_WRITE_SIZE) {
+            ok = false;
+        }
+    }
+
+    // A dispatcher may drop a task, e.g. when the main loop it posts to is
+    // gone. Later completions must still be called back.
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        bool dropped = false;
+        int done = 0;
+        auto &manager = CurlMultiManager::shared();
+        manager.set_dispatch([&](std::function<void()> task) {
+            std::lock_guard lock(mutex);
+            if (!dropped) {
+                dropped = true;
+                return;
+            }
+            tasks.push_back(std::move(task));
+            cv.notify_one();
+        });
+        for (int i = 0; i < 5; ++i) {
+            CURL *easy = manager.acquire();
+            curl_easy_setopt(
+                easy, CURLOPT_URL,
+                (base + "/delay/" + std::to_string(20 * i)).c_str());
+            manager.add(easy, [&](CURLcode, CURL *, const std::string &) {
+                ++done;
+            });
+        }
+        auto deadline = steady_clock::now() + seconds(3);
+        std::unique_lock lock(mutex);
+        while (done < 5 && cv.wait_until(lock, deadline, [&] {
+            return !tasks.empty();
+        })) {
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+        lock.unlock();
+        manager.set_dispatch(nullptr);
+        std::cout << "after a dropped dispatch: " << done << " of 5 called back"
+                  << std::endl;
+        if (done != 5) {
+            ok = false;
+        }
+    }
+
+#ifdef __linux__
+    // Let the server finish delayed responses.
+    std::this_thread::sleep_for(milliseconds(500));
+    long before = context_switches();
+    std::this_thread::sleep_for(seconds(1));
+    // Only the sleep of this thread itself is expected.
+    long wakeups = context_switches() - before;
+    std::cout << "context switches while idle for 1 s: " << wakeups
+              << std::endl;
+    if (wakeups > 5) {
+        ok = false;
+    }
+#endif
+    return ok ? 0 : 1;
+}
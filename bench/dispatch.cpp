@@ -0,0 +1,93 @@
+// Compare HandlerRegistry::call with the nlohmann::json path it used to
+// take, on the resize call the page sends on every panel change.
+#include "webview_candidate_window.hpp"
+#include <chrono>
+#include <iostream>
+
+using namespace candidate_window;
+
+using ResizeArgs = std::tuple<uint32_t, double, double, double, double,
+                              double, double, double, double, double, double,
+                              double, double, double, double, double, double,
+                              double, bool>;
+
+static const char *message =
+    R"(["resize",3,0,0,12.5,240.25,40.5,10.5,10.5,240.25,40.5,10.5,6,6,6,6,1,)"
+    R"(260.75,60.5,false])";
+
+static double checksum = 0;
+
+static void consume(const ResizeArgs &args) {
+    std::apply([](auto... a) { checksum += (static_cast<double>(a) + ...); },
+               args);
+}
+
+template <typename Tuple, size_t... Is>
+static Tuple json_to_tuple(const nlohmann::json &j,
+                           std::index_sequence<Is...>) {
+    return {j[Is].get<typename std::tuple_element<Is, Tuple>::type>()...};
+}
+
+static std::string old_path(const std::string &s) {
+    auto args = nlohmann::json::parse(s);
+    std::string name = args[0].get<std::string>();
+    if (name != "resize") {
+        return "";
+    }
+    args.erase(args.begin());
+    consume(json_to_tuple<ResizeArgs>(
+        args, std::make_index_sequence<std::tuple_size_v<ResizeArgs>>{}));
+    return "";
+}
+
+template <typename F> static double measure(int iterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+    HandlerRegistry handlers;
+    handlers.add(
+        "resize", make_handler("resize", [](uint32_t epoch, double dx,
+                                            double dy, double anchor_top,
+                                            double anchor_right,
+                                            double anchor_bottom,
+                                            double anchor_left,
+                                            double panel_top,
+                                            double panel_right,
+                                            double panel_bottom,
+                                            double panel_left, double tl,
+                                            double tr, double br, double bl,
+                                            double border_width, double width,
+                                            double height, bool dragging) {
+            consume({epoch, dx, dy, anchor_top, anchor_right, anchor_bottom,
+                     anchor_left, panel_top, panel_right, panel_bottom,
+                     panel_left, tl, tr, br, bl, border_width, width, height,
+                     dragging});
+        }));
+
+    // Both paths must decode the same values.
+    std::string s = message;
+    old_path(s);
+    double expected = checksum;
+    checksum = 0;
+    handlers.call(s);
+    if (checksum != expected) {
+        std::cerr << "Mismatch: " << checksum << " != " << expected
+                  << std::endl;
+        return 1;
+    }
+
+    double old_ns = measure(iterations, [&] { old_path(s); });
+    std::cout << "nlohmann::json:  " << old_ns << " ns/call" << std::endl;
+    double new_ns = measure(iterations, [&] { handlers.call(s); });
+    std::cout << "HandlerRegistry: " << new_ns << " ns/call" << std::endl;
+    std::cout << "speedup:         " << old_ns / new_ns << "x" << std::endl;
+    return 0;
+}
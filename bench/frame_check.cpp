@@ -0,0 +1,53 @@
+// Check what show() sends to the page after changes that don't touch panel
+// state, through a StubBridge. Exits with 1 on the first failure.
+#include "webview_candidate_window.hpp"
+#include <iostream>
+
+using namespace candidate_window;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+int main() {
+    auto bridge = std::make_unique<StubBridge>();
+    StubBridge *stub = bridge.get();
+    WebviewCandidateWindow window(std::move(bridge), [] {});
+    stub->call("fcitx", R"(["onload"])");
+
+    window.set_paging_buttons(true, false, true);
+    window.set_candidates({{"输入", "1", "", {}}, {"书", "2", "", {}}}, 0,
+                          scroll_state_t::none, false, false);
+    stub->run_pending();
+    window.show(100, 200, 18);
+    stub->evals.clear();
+    window.show(100, 200, 18);
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("\"candidates") == std::string::npos,
+           "unchanged show() sends no candidates");
+
+    // Mark text and paging buttons are rendered with candidates, so a new
+    // style needs them whole, not an empty patch.
+    window.set_style(R"({"Highlight":{"MarkStyle":"Text"}})");
+    stub->evals.clear();
+    window.show(100, 200, 18);
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("\"candidates\":") != std::string::npos,
+           "show() after set_style() re-renders candidates");
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("\"preedit\":") != std::string::npos,
+           "show() after set_style() re-renders preedit");
+
+    // Back to diffs once synced again.
+    stub->evals.clear();
+    window.show(100, 200, 18);
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("\"candidates") == std::string::npos,
+           "second show() after set_style() sends no candidates");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+// Minimal HTTP/1.1 server on loopback for curl benchmarks, one thread per
+// connection.
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// GET /echo/<text> responds with text, GET /delay/<ms> responds after ms,
+// GET /bytes/<n> responds with n bytes.
+inline void serve(int client) {
+    std::string request;
+    char chunk[1024];
+    ssize_t n;
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           (n = read(client, chunk, sizeof(chunk))) > 0) {
+        request.append(chunk, n);
+    }
+    auto start = request.find(' ') + 1;
+    auto path = request.substr(start, request.find(' ', start) - start);
+    std::string body;
+    if (path.rfind("/echo/", 0) == 0) {
+        body = path.substr(6);
+    } else if (path.rfind("/delay/", 0) == 0) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(std::stoi(path.substr(7))));
+    } else if (path.rfind("/bytes/", 0) == 0) {
+        body.assign(std::stoul(path.substr(7)), 'x');
+    }
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                           std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+    for (size_t written = 0; written < response.size();) {
+        ssize_t n = write(client, response.data() + written,
+                          response.size() - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    close(client);
+}
+
+inline int start_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr *)&addr, len) < 0 || listen(fd, 1024) < 0 ||
+        getsockname(fd, (sockaddr *)&addr, &len) < 0) {
+        perror("server");
+        exit(1);
+    }
+    std::thread([fd] {
+        int client;
+        while ((client = accept(fd, nullptr, nullptr)) >= 0) {
+            std::thread(serve, client).detach();
+        }
+    }).detach();
+    return ntohs(addr.sin_port);
+}
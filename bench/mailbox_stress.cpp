@@ -0,0 +1,81 @@
+// Hammer Mailbox<PanelState> from an engine-like producer while a consumer
+// checks every snapshot it picks up is consistent and never goes back.
+// Build with -DCMAKE_CXX_FLAGS=-fsanitize=thread to let TSan watch as well.
+#include "webview_candidate_window.hpp"
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+using namespace candidate_window;
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 1000000;
+    Mailbox<PanelState> mailbox;
+    std::atomic<bool> done = false;
+
+    std::thread producer([&] {
+        PanelState staging;
+        for (int i = 1; i <= iterations; ++i) {
+            // Candidates and preedit change at different rates, so that
+            // update_from has to merge fields from different publishes.
+            if (i % 3 == 0) {
+                auto text = std::to_string(i);
+                staging.candidates = {{text, "1", text, {}},
+                                      {text, "2", text, {}}};
+                staging.highlighted = i;
+                staging.touch(panel_field_t::candidates);
+            }
+            staging.preedit_pre_caret = {{std::to_string(i), 0}};
+            staging.has_caret = i % 2;
+            staging.touch(panel_field_t::preedit);
+            mailbox.back().update_from(staging);
+            mailbox.publish();
+        }
+        done = true;
+    });
+
+    int last = 0;
+    int last_highlighted = -1;
+    size_t pickups = 0;
+    auto check = [&] {
+        const PanelState &state = mailbox.front();
+        int i = std::stoi(state.preedit_pre_caret[0].first);
+        if (i <= last || state.has_caret != bool(i % 2)) {
+            std::cerr << "Stale or torn preedit at " << i << std::endl;
+            return false;
+        }
+        last = i;
+        if (state.highlighted != -1) {
+            auto text = std::to_string(state.highlighted);
+            if (state.highlighted != i / 3 * 3 ||
+                state.highlighted < last_highlighted ||
+                state.candidates.size() != 2 ||
+                state.candidates[0].text != text ||
+                state.candidates[1].comment != text) {
+                std::cerr << "Torn candidates at " << i << std::endl;
+                return false;
+            }
+            last_highlighted = state.highlighted;
+        }
+        return true;
+    };
+    bool ok = true;
+    while (ok && !done) {
+        if (mailbox.consume()) {
+            ++pickups;
+            ok = check();
+        }
+    }
+    producer.join();
+    if (ok && mailbox.consume()) {
+        ++pickups;
+        ok = check();
+    }
+    if (ok && last != iterations) {
+        std::cerr << "Lost last publish: " << last << std::endl;
+        ok = false;
+    }
+    std::cout << iterations << " publishes, " << pickups << " pickups"
+              << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+// Type a million keystrokes into WebviewCandidateWindow through a StubBridge,
+// hiding the panel after each word and releasing memory as an idle panel
+// would, and check that resident memory of the process stays flat. WebKit's
+// processes are not involved; run preview with --soak for them.
+#include "webview_candidate_window.hpp"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+using namespace candidate_window;
+
+static const char *texts[] = {"输入法", "输入", "书",   "属于", "数字",
+                              "😄",     "树木", "殊途", "舒适", "叔叔"};
+
+int main(int argc, char *argv[]) {
+    int keystrokes = argc > 1 ? std::stoi(argv[1]) : 1000000;
+    // Allocator and caches settle in the first part.
+    int warmup = keystrokes / 10;
+    auto bridge = std::make_unique<StubBridge>();
+    StubBridge *stub = bridge.get();
+    stub->record_evals = false;
+    WebviewCandidateWindow window(std::move(bridge), [] {});
+    stub->call("fcitx", R"(["onload"])");
+
+    const char *preedits[] = {"s", "sh", "shu", "shur", "shuru"};
+    const char *resize =
+        R"(["resize",0,0,0,12,240,40,10,10,240,40,10,6,6,6,6,1,260,60,false])";
+    size_t baseline = 0;
+    size_t peak = 0;
+    for (int i = 0; i < keystrokes; ++i) {
+        std::vector<Candidate> candidates;
+        // Candidates of varying count and length, as a real session has.
+        for (int j = 0; j < 5 + i % 6; ++j) {
+            candidates.push_back({std::string(texts[(i + j) % 10]) +
+                                      std::to_string(i % 1000),
+                                  std::to_string(j + 1), i % 7 ? "" : "shū",
+                                  {}});
+        }
+        window.update_input_panel({{preedits[i % 5], 0}}, i % 5 + 1, {}, {});
+        window.set_candidates(std::move(candidates), 0, scroll_state_t::none,
+                              false, false);
+        stub->run_pending();
+        window.show(100, 200, 18);
+        stub->call("fcitx", resize);
+        if (i % 5 == 4) {
+            window.hide();
+        }
+        if (i % 5000 == 4999) {
+            window.release_memory();
+        }
+        if (i >= warmup && (i + 1) % (keystrokes / 10) == 0) {
+            size_t rss = window.memory_usage().ui_process;
+            if (!baseline) {
+                baseline = rss;
+            }
+            peak = std::max(peak, rss);
+            std::cout << i + 1 << " keystrokes: " << rss / 1024 << " KB"
+                      << std::endl;
+        }
+    }
+    // Allow for noise of the allocator, not for growth with keystrokes.
+    size_t tolerance = 4 << 20;
+    if (peak > baseline + tolerance) {
+        std::cerr << "Resident memory grew by " << (peak - baseline) / 1024
+                  << " KB after warmup" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Check what scrollRange answers from the candidates kept for the expanded
+// scroll mode, through a StubBridge. Exits with 1 on the first failure.
+#include "webview_candidate_window.hpp"
+#include <iostream>
+
+using namespace candidate_window;
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static std::vector<Candidate> candidates(const std::string &prefix, int begin,
+                                         int end) {
+    std::vector<Candidate> cands;
+    for (int i = begin; i < end; ++i) {
+        cands.push_back({prefix + std::to_string(i), "", "", {}});
+    }
+    return cands;
+}
+
+static bool has(const std::string &js, const std::string &text) {
+    return js.find("\"" + text + "\"") != std::string::npos;
+}
+
+int main() {
+    auto bridge = std::make_unique<StubBridge>();
+    StubBridge *stub = bridge.get();
+    WebviewCandidateWindow window(std::move(bridge), [] {});
+    stub->call("fcitx", R"(["onload"])");
+
+    // Expand, then append a page as scroll does.
+    window.set_candidates(candidates("c", 0, 42), 0, scroll_state_t::scrolling,
+                          true, false);
+    window.show(100, 200, 18);
+    window.set_candidates(candidates("c", 42, 78), -1,
+                          scroll_state_t::scrolling, false, true);
+    window.show(100, 200, 18);
+
+    stub->evals.clear();
+    stub->call("fcitx", R"(["scrollRange", 7, 40, 10])");
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("setScrollRange(7,40,") !=
+                   std::string::npos,
+           "scrollRange answers with its session and start");
+    expect(stub->evals.size() == 1 && has(stub->evals[0], "c40") &&
+               has(stub->evals[0], "c41") && has(stub->evals[0], "c49") &&
+               !has(stub->evals[0], "c39") && !has(stub->evals[0], "c50"),
+           "scrollRange spans both fetched pages");
+
+    stub->evals.clear();
+    stub->call("fcitx", R"(["scrollRange", 7, 70, 100])");
+    expect(stub->evals.size() == 1 && has(stub->evals[0], "c77") &&
+               !has(stub->evals[0], "c69"),
+           "scrollRange is clamped to candidates fetched");
+
+    // New candidates replace, not append to, the kept ones.
+    window.set_candidates(candidates("n", 0, 3), 0, scroll_state_t::scrolling,
+                          true, true);
+    window.show(100, 200, 18);
+    stub->evals.clear();
+    stub->call("fcitx", R"(["scrollRange", 8, 0, 10])");
+    expect(stub->evals.size() == 1 && has(stub->evals[0], "n0") &&
+               has(stub->evals[0], "n2") && !has(stub->evals[0], "c0"),
+           "scrollRange after scroll start has only new candidates");
+
+    // Collapsed, nothing is kept.
+    window.set_candidates(candidates("p", 0, 5), 0, scroll_state_t::none,
+                          false, false);
+    window.show(100, 200, 18);
+    stub->evals.clear();
+    stub->call("fcitx", R"(["scrollRange", 9, 0, 10])");
+    expect(stub->evals.size() == 1 &&
+               stub->evals[0].find("setScrollRange(9,0,[])") !=
+                   std::string::npos,
+           "scrollRange after collapse is empty");
+    return failures ? 1 : 0;
+}
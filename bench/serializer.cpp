@@ -0,0 +1,82 @@
+// Compare write_js with the nlohmann::json path invoke_js used to take, on
+// candidate lists typical for Chinese input methods.
+#include "webview_candidate_window.hpp"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+using namespace candidate_window;
+
+static std::vector<Candidate> make_candidates() {
+    static const char *texts[] = {
+        "输入法", "输入", "书", "属于", "数字",
+        "😄",     "树木", "殊途同归", "舒适", "叔叔"};
+    static const char *comments[] = {
+        "shū rù fǎ", "", "〔書〕", "", "", "笑脸", "", "成语", "", ""};
+    std::vector<Candidate> candidates;
+    for (int i = 0; i < 10; ++i) {
+        Candidate c{texts[i], std::to_string((i + 1) % 10), comments[i], {}};
+        if (i % 3 == 0) {
+            c.actions = {{0, "删词"}, {1, "置顶"}};
+        }
+        candidates.push_back(std::move(c));
+    }
+    // A comment with characters that need escaping.
+    candidates[1].comment = "\"引号\"\t\\";
+    return candidates;
+}
+
+static void old_path(std::stringstream &ss,
+                     const std::vector<Candidate> &candidates,
+                     int highlighted) {
+    ss << "fcitx.setCandidates(" << nlohmann::json(candidates).dump() << ", "
+       << nlohmann::json(highlighted).dump() << ");";
+}
+
+static void new_path(std::string &out, const std::vector<Candidate> &candidates,
+                     int highlighted) {
+    out += "fcitx.setCandidates(";
+    write_js_args(out, candidates, highlighted);
+    out += ");";
+}
+
+template <typename F> static double measure(int iterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+    auto candidates = make_candidates();
+
+    std::string out;
+    write_js(out, candidates);
+    if (nlohmann::json::parse(out) != nlohmann::json(candidates)) {
+        std::cerr << "Mismatch: " << out << std::endl;
+        return 1;
+    }
+
+    size_t bytes = 0;
+    double old_ns = measure(iterations, [&] {
+        std::stringstream ss;
+        old_path(ss, candidates, 0);
+        bytes = ss.str().size();
+    });
+    std::cout << "nlohmann::json: " << old_ns << " ns/call, " << bytes
+              << " bytes" << std::endl;
+
+    double new_ns = measure(iterations, [&] {
+        out.clear(); // Buffer is reused like invoke_js does.
+        new_path(out, candidates, 0);
+        bytes = out.size();
+    });
+    std::cout << "write_js:       " << new_ns << " ns/call, " << bytes
+              << " bytes" << std::endl;
+    std::cout << "speedup:        " << old_ns / new_ns << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+# Embed the page built by parcel into a header, gzipped. The module script
+# that parcel inlines into index.html is moved to a file named by its hash,
+# so that WebKit can cache it across starts.
+#
+# cmake -DDIST=<dist> -DWORK=<scratch dir> -DOUTPUT=<header> -P embed_page.cmake
+
+file(READ "${DIST}/index.html" html)
+string(REGEX MATCH "<script[^>]*>" tag "${html}")
+if(NOT tag OR tag MATCHES " src=")
+    message(FATAL_ERROR "No inline script in ${DIST}/index.html")
+endif()
+string(FIND "${html}" "${tag}" tag_start)
+string(LENGTH "${tag}" tag_length)
+math(EXPR script_start "${tag_start} + ${tag_length}")
+string(SUBSTRING "${html}" ${script_start} -1 rest)
+string(FIND "${rest}" "</script>" script_length)
+string(SUBSTRING "${rest}" 0 ${script_length} script)
+math(EXPR tail_start "${script_length} + 9") # After </script>
+string(SUBSTRING "${rest}" ${tail_start} -1 tail)
+string(SUBSTRING "${html}" 0 ${tag_start} head)
+
+string(SHA256 hash "${script}")
+string(SUBSTRING "${hash}" 0 8 hash)
+set(script_name "index.${hash}.js")
+string(REPLACE ">" " src=\"${script_name}\">" tag "${tag}")
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}")
+file(WRITE "${WORK}/index.html" "${head}${tag}</script>${tail}")
+file(WRITE "${WORK}/${script_name}" "${script}")
+# Anything else parcel emits, e.g. images, is served as is.
+file(GLOB others "${DIST}/*")
+foreach(file IN LISTS others)
+    get_filename_component(name "${file}" NAME)
+    if(NOT name STREQUAL "index.html" AND NOT name MATCHES "\\.map$")
+        file(COPY "${file}" DESTINATION "${WORK}")
+    endif()
+endforeach()
+
+set(arrays "")
+set(table "")
+set(i 0)
+file(GLOB assets RELATIVE "${WORK}" "${WORK}/*")
+foreach(name IN LISTS assets)
+    execute_process(
+        COMMAND gzip -9 -n -c "${WORK}/${name}"
+        OUTPUT_FILE "${WORK}/${i}.gz"
+        COMMAND_ERROR_IS_FATAL ANY
+    )
+    execute_process(
+        COMMAND xxd -n PAGE_ASSET_${i} -i "${WORK}/${i}.gz"
+        OUTPUT_VARIABLE array
+        COMMAND_ERROR_IS_FATAL ANY
+    )
+    string(REPLACE "unsigned" "static const unsigned" array "${array}")
+    string(APPEND arrays "${array}")
+    string(APPEND table
+        "    {\"${name}\", PAGE_ASSET_${i}, PAGE_ASSET_${i}_len},\n")
+    math(EXPR i "${i} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}"
+"// Generated by cmake/embed_page.cmake. Do not edit.
+#pragma once
+
+${arrays}
+static const struct {
+    const char *path;
+    const unsigned char *gzipped;
+    unsigned int size;
+} PAGE_ASSETS[] = {
+${table}};
+")
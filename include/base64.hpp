@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Base64 of the standard alphabet with padding. Vectorized with AVX2 or
+// SSSE3 if the CPU supports them, which is checked once at runtime.
+
+// Append the encoding of in to out.
+void base64_encode(std::string_view in, std::string &out);
+// Append the bytes encoded by in to out. Padding is optional. Returns false
+// if in is not valid base64, leaving out with unspecified content.
+bool base64_decode(std::string_view in, std::string &out);
+
+// Name of the implementation chosen for this CPU.
+const char *base64_isa();
+// Portable implementations, for comparison.
+void base64_encode_scalar(std::string_view in, std::string &out);
+bool base64_decode_scalar(std::string_view in, std::string &out);
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace candidate_window {
+// What WebviewCandidateWindow needs from the page. The webview one is made by
+// make_webview_bridge, and StubBridge runs in process without a display.
+class Bridge {
+  public:
+    // Called with arguments as a JSON array, returns result as JSON.
+    using handler_t = std::function<std::string(std::string_view args)>;
+    // Called with id of a promise to be settled later by resolve().
+    using async_handler_t =
+        std::function<void(std::string id, std::string args)>;
+
+    virtual ~Bridge() = default;
+
+    virtual void eval(const std::string &js) = 0;
+    virtual void set_html(const std::string &html) = 0;
+    // Expose window[name] to JS.
+    virtual void bind(const std::string &name, handler_t handler) = 0;
+    virtual void bind_async(const std::string &name,
+                            async_handler_t handler) = 0;
+    virtual void unbind(const std::string &name) = 0;
+    // status is 0 to fulfill and others to reject. Any thread.
+    virtual void resolve(const std::string &id, int status,
+                         const std::string &result) = 0;
+    // Run f on main thread. Any thread.
+    virtual void dispatch(std::function<void()> f) = 0;
+
+    // Native handles for platform code, null if headless.
+    virtual void *window() { return nullptr; }
+    virtual void *widget() { return nullptr; }
+    virtual void *browser_controller() { return nullptr; }
+};
+
+#ifndef __EMSCRIPTEN__
+// Create webview in window, or a new one if window is null.
+std::unique_ptr<Bridge> make_webview_bridge(void *window);
+#endif
+
+// Records what C++ sends to the page, and lets a test or benchmark act as
+// the page by calling bound functions. Deterministic: dispatched tasks only
+// run in run_pending().
+class StubBridge : public Bridge {
+  public:
+    void eval(const std::string &js) override {
+        ++eval_count;
+        if (record_evals) {
+            evals.push_back(js);
+        }
+    }
+    void set_html(const std::string &html) override { this->html = html; }
+    void bind(const std::string &name, handler_t handler) override {
+        handlers_[name] = std::move(handler);
+    }
+    void bind_async(const std::string &name,
+                    async_handler_t handler) override {
+        async_handlers_[name] = std::move(handler);
+    }
+    void unbind(const std::string &name) override {
+        handlers_.erase(name);
+        async_handlers_.erase(name);
+    }
+    void resolve(const std::string &id, int status,
+                 const std::string &result) override {
+        std::lock_guard lock(mutex_);
+        resolved.push_back({id, status, result});
+    }
+    void dispatch(std::function<void()> f) override {
+        std::lock_guard lock(mutex_);
+        pending_.push_back(std::move(f));
+    }
+
+    // Call window[name](...args) as the page would. Returns "" if unbound.
+    std::string call(const std::string &name, std::string_view args) {
+        auto iter = handlers_.find(name);
+        return iter == handlers_.end() ? "" : iter->second(args);
+    }
+    // Same for async bindings, whose result goes to resolved.
+    void call_async(const std::string &name, const std::string &id,
+                    const std::string &args) {
+        auto iter = async_handlers_.find(name);
+        if (iter != async_handlers_.end()) {
+            iter->second(id, args);
+        }
+    }
+    // Run dispatched tasks, including those they dispatch. Returns how many.
+    size_t run_pending() {
+        size_t n = 0;
+        while (true) {
+            std::function<void()> f;
+            {
+                std::lock_guard lock(mutex_);
+                if (pending_.empty()) {
+                    return n;
+                }
+                f = std::move(pending_.front());
+                pending_.pop_front();
+            }
+            f();
+            ++n;
+        }
+    }
+
+    struct Resolution {
+        std::string id;
+        int status;
+        std::string result;
+    };
+
+    bool record_evals = true;
+    size_t eval_count = 0;
+    std::vector<std::string> evals;
+    std::string html;
+    std::vector<Resolution> resolved; // Guarded by mutex_ while running.
+
+  private:
+    std::unordered_map<std::string, handler_t> handlers_;
+    std::unordered_map<std::string, async_handler_t> async_handlers_;
+    std::mutex mutex_;
+    std::deque<std::function<void()>> pending_;
+};
+} // namespace candidate_window
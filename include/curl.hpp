@@ -1,27 +1,169 @@
 #pragma once
 
+#include "mpsc_queue.hpp"
+#include "slab.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <curl/curl.h>
+#include <deque>
 #include <functional>
-#include <shared_mutex>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+struct CurlPoolStats {
+    uint64_t acquired = 0;           // Easy handles handed out by acquire().
+    uint64_t reused = 0;             // Of which came from the pool.
+    uint64_t transfers = 0;          // Successful transfers.
+    uint64_t connections_reused = 0; // Of which made no new connection.
+    uint64_t handshakes_avoided = 0; // Of which over TLS.
+    double reuse_ratio() const {
+        return acquired ? static_cast<double>(reused) / acquired : 0;
+    }
+};
+
+// Which requests go first when there are more than the limits allow.
+enum class CurlPriority {
+    kInteractive, // Someone waits for it, e.g. cloud candidates.
+    kNormal,
+    kBulk, // Prefetching images, dictionaries and the like.
+};
+inline constexpr size_t kCurlPriorities = 3;
+
+struct CurlLimits {
+    long max_connections = 32;     // Open at once, to all hosts.
+    long max_host_connections = 6; // Open at once, to one host.
+    // Transfers at once of a priority and those below it, by priority. So
+    // bulk ones never take all the room, and the rest wait in a queue that
+    // admits higher priorities first.
+    std::array<size_t, kCurlPriorities> max_transfers = {64, 32, 4};
+};
+
+struct CurlQueueStats {
+    uint64_t admitted = 0; // Requests that left the queue for the network.
+    double total_ms = 0;   // Time they spent in it.
+    double max_ms = 0;
+    double mean_ms() const { return admitted ? total_ms / admitted : 0; }
+};
+
+// Runs transfers on a worker thread that sleeps in epoll (kqueue on macOS)
+// until a socket is ready or the earliest curl timeout expires, so timeouts
+// are accurate to the millisecond and there is no wakeup while idle.
+//
+// Requests go to the worker through a lock-free queue, and their state lives
+// in a slab, attached to the easy handle with CURLOPT_PRIVATE. Finished ones
+// go through another queue to the thread given by set_dispatch(), so that
+// no callback holds up the worker or other submitters.
+//
+// Transfers to the same host share HTTP/2 connections where possible.
 class CurlMultiManager {
   public:
     using Callback = std::function<void(CURLcode, CURL *, const std::string &)>;
-    using HandleData = std::pair<CURL *, Callback>;
+    // Takes each chunk of a streamed response on the worker thread, and
+    // returns size, or CURL_WRITEFUNC_PAUSE to get the chunk again after
+    // resume().
+    using DataCallback = std::function<size_t(const char *data, size_t size)>;
 
     static CurlMultiManager &shared();
-    CurlMultiManager();
+    explicit CurlMultiManager(CurlLimits limits = {});
     ~CurlMultiManager();
-    void add(CURL *easy, CurlMultiManager::Callback cb);
+    // Any thread. callback runs where set_dispatch() says, after which easy
+    // goes back to the pool. Returns an id for cancel(). With on_data, the
+    // body is streamed to it instead of buffered for cb. The timeout of easy
+    // starts when it leaves the queue.
+    uint64_t add(CURL *easy, CurlMultiManager::Callback cb,
+                 DataCallback on_data = nullptr,
+                 CurlPriority priority = CurlPriority::kNormal);
+    // Any thread. Abort the transfer if it's still running, whose callback
+    // then gets CURLE_ABORTED_BY_CALLBACK. No-op if it has finished.
+    void cancel(uint64_t id);
+    // Any thread. Continue a transfer paused by its DataCallback.
+    void resume(uint64_t id);
+    // Any thread. A reset easy handle sharing DNS and TLS session caches with
+    // others. Connections are already shared by the multi handle.
+    CURL *acquire();
+    // Any thread. Return a handle from acquire() that won't be added.
+    void release(CURL *easy);
+    CurlPoolStats pool_stats();
+    // Time requests waited for the limits, by priority.
+    std::array<CurlQueueStats, kCurlPriorities> queue_stats();
+    // Any thread. Callbacks are run by a task passed to dispatch, e.g. one
+    // that posts to the main loop. Without it they run on the worker thread.
+    void set_dispatch(std::function<void(std::function<void()>)> dispatch);
+    // Requests added and not yet called back.
+    size_t live_requests() { return requests.live(); }
 
   private:
+    struct Request;
+    struct Command {
+        enum Op { kAdd, kCancel, kResume };
+        Command *next = nullptr;
+        Op op;
+        uint64_t id;
+        Request *request = nullptr; // Of kAdd.
+    };
+    // From add() until the callback returns.
+    struct Request {
+        Request *next = nullptr; // In completions.
+        Command submit;
+        CURL *easy;
+        Callback cb;
+        DataCallback on_data;
+        std::string buf;
+        CURLcode result = CURLE_OK;
+        size_t priority;
+        bool admitted = false; // Into multi, out of waiting.
+        std::chrono::steady_clock::time_point queued;
+    };
+
     CURLM *multi;
     std::thread worker_thread;
     int controlfd[2];
-    std::shared_mutex m;
-    std::unordered_map<CURL *, std::string> buf;
-    std::unordered_map<CURL *, Callback> cb;
+    int pollfd = -1; // epoll or kqueue
+#ifdef __linux__
+    int timerfd = -1;
+#endif
+    std::atomic<bool> quitting = false;
+    std::atomic<uint64_t> next_id = 0;
+    Slab<Request> requests;
+    MpscQueue<Command> submissions;
+    MpscQueue<Request> completions;
+    std::mutex dispatch_mutex;
+    std::function<void(std::function<void()>)> dispatch;
+    const CurlLimits limits;
+    // Worker only. Requests submitted and not completed by id, which are
+    // either waiting or admitted into multi.
+    std::unordered_map<uint64_t, Request *> live;
+    std::deque<Request *> waiting[kCurlPriorities];
+    size_t transfers[kCurlPriorities] = {}; // Admitted.
+
+    static constexpr size_t kMaxPooled = 16;
+    CURLSH *share;
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+    std::mutex pool_mutex;
+    std::vector<CURL *> pool;
+    CurlPoolStats stats;
+    std::array<CurlQueueStats, kCurlPriorities> queue; // Under pool_mutex.
 
     void run();
+    void submit(Command *command);
+    void run_commands();
+    void admit();
+    void check_done();
+    void complete(Request *request);
+    void finish(Request *request);
+    void drain_completions();
+    void cleanup_all();
+    void record_transfer(CURL *easy);
+    void watch(curl_socket_t s, int what, bool added);
+    void set_timer(long timeout_ms);
+    static int on_socket(CURL *easy, curl_socket_t s, int what, void *userp,
+                         void *socketp);
+    static int on_timer(CURLM *multi, long timeout_ms, void *userp);
+    static size_t write_data(char *data, size_t size, size_t nmemb,
+                             Request *request);
 };
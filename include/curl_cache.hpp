@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <curl/curl.h>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct CachedResponse {
+    long status = 0;
+    std::string data;
+    std::string etag;
+    std::string last_modified;
+    int64_t expires = 0; // Unix time after which it must be revalidated.
+
+    bool fresh(int64_t now) const { return now < expires; }
+    bool revalidatable() const {
+        return !etag.empty() || !last_modified.empty();
+    }
+};
+
+// LRU cache of curl responses that honors Cache-Control, Expires, ETag and
+// Last-Modified. Used where curl callbacks are dispatched, normally main
+// thread, and locked for any other.
+class CurlCache {
+  public:
+    static CurlCache &shared();
+    ~CurlCache();
+
+    // headers are those of the request, in any order.
+    static std::string
+    make_key(const std::string &method, const std::string &url,
+             const std::unordered_map<std::string, std::string> &headers,
+             const std::string &body);
+
+    std::optional<CachedResponse> lookup(const std::string &key);
+    // Store a finished transfer if its response headers allow. Responses to
+    // other methods than GET are only stored while explicitly fresh, as
+    // they can't be revalidated with a conditional request.
+    void store(const std::string &key, const std::string &method, CURL *easy,
+               long status, const std::string &data);
+    // Refresh the entry confirmed by a 304 response to easy, and return it.
+    std::optional<CachedResponse> revalidate(const std::string &key,
+                                             CURL *easy);
+
+    void set_capacity(size_t bytes);
+    // Load entries saved at path, and save to it every kSaveEvery new
+    // entries and on exit. Empty path disables.
+    void set_file(const std::string &path);
+    void save();
+
+  private:
+    // So that a crash loses few entries, without rewriting the file for each.
+    static constexpr size_t kSaveEvery = 16;
+
+    struct Entry {
+        CachedResponse response;
+        // Body of an entry loaded from the file and not yet looked up, in
+        // the mapping of it. response.data is empty meanwhile.
+        std::string_view mapped;
+    };
+    using Lru = std::list<std::pair<std::string, Entry>>;
+
+    std::mutex m;
+    Lru lru; // Most recently used first.
+    std::unordered_map<std::string, Lru::iterator> index;
+    size_t bytes = 0;
+    size_t capacity = 8 << 20;
+    std::string path;
+    // Of the file at path as loaded, which bodies are read from lazily.
+    void *map = nullptr;
+    size_t map_size = 0;
+    size_t unsaved = 0; // Entries inserted since the last save.
+
+    // Caller holds m.
+    void insert(std::string key, Entry entry);
+    void erase(Lru::iterator it);
+    void evict();
+    void load();
+    void save_locked();
+    // Move the body of entry out of the mapping.
+    static void read_body(Entry &entry);
+    // Copy bodies out of the mapping and unmap it.
+    void unmap();
+};
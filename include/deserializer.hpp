@@ -0,0 +1,55 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace candidate_window {
+// Read arguments of JS calls (a JSON array) in place, without building a
+// nlohmann::json. Counterpart of serializer.hpp.
+
+// Split the top-level array s into slices of its elements. Nested arrays,
+// objects and strings are only checked for balance here, and elements are
+// validated when read. Returns false if s is not an array.
+bool split_js_array(std::string_view s, std::vector<std::string_view> &out);
+
+// Specialize js_deserializer for new types. read returns false if s is not
+// a valid literal of T.
+template <typename T, typename Enable = void> struct js_deserializer;
+
+template <typename T> inline bool read_js(std::string_view s, T &value) {
+    return js_deserializer<T>::read(s, value);
+}
+
+// Unquote and unescape a JSON string.
+bool read_js_string(std::string_view s, std::string &out);
+
+template <> struct js_deserializer<bool> {
+    static bool read(std::string_view s, bool &value) {
+        if (s == "true" || s == "false") {
+            value = s[0] == 't';
+            return true;
+        }
+        return false;
+    }
+};
+
+template <typename T>
+struct js_deserializer<T, std::enable_if_t<std::is_arithmetic_v<T> &&
+                                           !std::is_same_v<T, bool>>> {
+    static bool read(std::string_view s, T &value) {
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+        return ec == std::errc() && end == s.data() + s.size();
+    }
+};
+
+template <> struct js_deserializer<std::string> {
+    static bool read(std::string_view s, std::string &value) {
+        return read_js_string(s, value);
+    }
+};
+} // namespace candidate_window
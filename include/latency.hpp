@@ -0,0 +1,131 @@
+#pragma once
+
+#include "serializer.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace candidate_window {
+using latency_clock = std::chrono::steady_clock;
+
+// Durations in power-of-2 nanosecond buckets, so that recording is a few
+// instructions and memory is fixed. Bucket i holds [2^(i-1), 2^i) ns.
+class LatencyHistogram {
+  public:
+    static constexpr size_t kBuckets = 40; // Up to about 9 minutes.
+
+    void record(uint64_t ns);
+    void record(latency_clock::duration d) {
+        record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t sum_ns() const { return sum_ns_; }
+    uint64_t max_ns() const { return max_ns_; }
+    const std::array<uint64_t, kBuckets> &buckets() const { return buckets_; }
+    // Upper bound of the bucket where quantile q (0 to 1) falls, capped by
+    // max_ns(). 0 if empty.
+    uint64_t quantile_ns(double q) const;
+
+  private:
+    std::array<uint64_t, kBuckets> buckets_ = {};
+    uint64_t count_ = 0;
+    uint64_t sum_ns_ = 0;
+    uint64_t max_ns_ = 0;
+};
+
+// A timed event, kept in a ring of recent ones so that a spike can be
+// correlated with what was sent at that time.
+struct LatencyEvent {
+    // "invoke_js", "handler", "show_to_resize", "load" or "prewarm".
+    const char *stage = "";
+    const char *name = ""; // JS function or handler name.
+    uint32_t epoch = 0;
+    uint64_t start_ns = 0; // Since latency_clock's epoch.
+    uint64_t duration_ns = 0;
+};
+
+struct LatencyStats {
+    // Serializing and evaluating scripts, by JS function name.
+    std::map<std::string, LatencyHistogram, std::less<>> invoke_js;
+    // Running bound C++ functions called from JS, by name.
+    std::map<std::string, LatencyHistogram, std::less<>> handlers;
+    // From show() to the resize callback of the same epoch.
+    LatencyHistogram show_to_resize;
+    // Resize callbacks dropped because a newer show() happened.
+    uint64_t stale_resizes = 0;
+    // From construction of the window to onload of the page.
+    uint64_t load_ns = 0;
+    // show_to_resize of the first show(), which is the slowest unless the
+    // page was prewarmed.
+    uint64_t first_show_ns = 0;
+    // Rendering done by prewarm(), as timed by the page. 0 if none.
+    uint64_t prewarm_ns = 0;
+
+    static constexpr size_t kRecentEvents = 64;
+    std::array<LatencyEvent, kRecentEvents> recent = {};
+    uint64_t events = 0; // Total recorded; the newest is recent[(events-1)%N].
+
+    void record(const char *stage,
+                std::map<std::string, LatencyHistogram, std::less<>> &by_name,
+                std::string_view name, uint32_t epoch,
+                latency_clock::time_point start, latency_clock::time_point end);
+    void record_show_to_resize(uint32_t epoch, latency_clock::time_point start,
+                               latency_clock::time_point end);
+    void record_load(latency_clock::time_point start,
+                     latency_clock::time_point end);
+    void record_prewarm(double ms);
+
+  private:
+    void add_event(const char *stage, const char *name, uint32_t epoch,
+                   latency_clock::time_point start, uint64_t duration_ns);
+};
+
+template <> struct js_serializer<LatencyHistogram> {
+    static void write(std::string &out, const LatencyHistogram &h) {
+        js_object_writer o(out);
+        o.field("count", h.count());
+        o.field("sumNs", h.sum_ns());
+        o.field("maxNs", h.max_ns());
+        o.field("p50Ns", h.quantile_ns(0.5));
+        o.field("p99Ns", h.quantile_ns(0.99));
+        // Trailing empty buckets are omitted.
+        size_t n = h.buckets().size();
+        while (n && !h.buckets()[n - 1]) {
+            --n;
+        }
+        o.field("buckets", std::vector<uint64_t>(h.buckets().begin(),
+                                                 h.buckets().begin() + n));
+    }
+};
+
+template <typename V>
+struct js_serializer<std::map<std::string, V, std::less<>>> {
+    static void write(std::string &out,
+                      const std::map<std::string, V, std::less<>> &map) {
+        js_object_writer o(out);
+        for (const auto &[key, value] : map) {
+            o.field(key, value);
+        }
+    }
+};
+
+template <> struct js_serializer<LatencyEvent> {
+    static void write(std::string &out, const LatencyEvent &e) {
+        js_object_writer o(out);
+        o.field("stage", e.stage);
+        o.field("name", e.name);
+        o.field("epoch", e.epoch);
+        o.field("startNs", e.start_ns);
+        o.field("durationNs", e.duration_ns);
+    }
+};
+
+template <> struct js_serializer<LatencyStats> {
+    static void write(std::string &out, const LatencyStats &s);
+};
+} // namespace candidate_window
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace candidate_window {
+// Lock-free triple buffer for one producer thread and one consumer thread.
+// Producer fills back() and publishes it without ever blocking; consumer
+// picks up the newest published value, and intermediate ones are dropped.
+template <typename T> class Mailbox {
+  public:
+    // Producer only. Content is what was written to this buffer 1 or 2
+    // publishes ago (or default), so a producer that fills it incrementally
+    // must be able to tell what is stale.
+    T &back() { return buffers_[back_]; }
+
+    // Producer only. Returns true if the consumer had picked up the previous
+    // value, i.e. it needs to be notified of this one.
+    bool publish() {
+        uint8_t prev = middle_.exchange(back_ | kFresh,
+                                        std::memory_order_acq_rel);
+        back_ = prev & kIndexMask;
+        return !(prev & kFresh);
+    }
+
+    // Consumer only. Returns true if front() is replaced by a newer value.
+    bool consume() {
+        if (!(middle_.load(std::memory_order_relaxed) & kFresh)) {
+            return false;
+        }
+        uint8_t prev = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = prev & kIndexMask;
+        return true;
+    }
+
+    // Consumer only.
+    const T &front() const { return buffers_[front_]; }
+
+  private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFresh = 0x4;
+
+    T buffers_[3];
+    uint8_t back_ = 0;
+    std::atomic<uint8_t> middle_ = 1;
+    uint8_t front_ = 2;
+};
+} // namespace candidate_window
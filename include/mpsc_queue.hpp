@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+
+// Intrusive multi-producer single-consumer queue of nodes with a `T *next`
+// member. Producers push without locks, and the consumer takes everything
+// pushed so far in one exchange, so there is no ABA problem.
+template <typename T> class MpscQueue {
+  public:
+    // Any thread. Returns true if the queue was empty, i.e. the consumer
+    // needs a wakeup.
+    bool push(T *node) {
+        T *head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!head_.compare_exchange_weak(head, node,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    // Nodes pushed so far linked by next, oldest first. Concurrent callers
+    // each get a disjoint part.
+    T *take_all() {
+        T *node = head_.exchange(nullptr, std::memory_order_acquire);
+        T *reversed = nullptr;
+        while (node) {
+            T *next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        return reversed;
+    }
+
+  private:
+    std::atomic<T *> head_ = nullptr;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Files of the page built by parcel, embedded gzipped. index.html loads its
+// script from a separate file named by hash, so that a webview serving them
+// from a URI scheme can cache each by URL.
+
+// Decompressed content of the file at path, e.g. "index.html", or nullopt if
+// there is no such file.
+std::optional<std::string> page_asset(std::string_view path);
+// index.html with its scripts inlined, for webviews that load it as a string.
+std::string inline_page();
+// Guessed from the extension of path.
+const char *mime_type(std::string_view path);
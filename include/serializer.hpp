@@ -0,0 +1,186 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace candidate_window {
+// Serialize C++ values as JS literals (a subset of JSON) directly into a
+// reusable buffer, without building a temporary nlohmann::json.
+// Specialize js_serializer for new types.
+template <typename T, typename Enable = void> struct js_serializer;
+
+template <typename T> inline void write_js(std::string &out, const T &value) {
+    js_serializer<T>::write(out, value);
+}
+
+// Quote and escape s. Invalid UTF-8 is replaced by U+FFFD, and U+2028/U+2029
+// are escaped so the result is safe in both JSON and JS source.
+void write_js_string(std::string &out, std::string_view s);
+
+template <> struct js_serializer<bool> {
+    static void write(std::string &out, bool value) {
+        out += value ? "true" : "false";
+    }
+};
+
+template <> struct js_serializer<std::nullptr_t> {
+    static void write(std::string &out, std::nullptr_t) { out += "null"; }
+};
+
+template <typename T>
+struct js_serializer<T, std::enable_if_t<std::is_integral_v<T> &&
+                                         !std::is_same_v<T, bool>>> {
+    static void write(std::string &out, T value) {
+        char buf[24];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, end);
+    }
+};
+
+template <typename T>
+struct js_serializer<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static void write(std::string &out, T value) {
+        // Same as JSON.stringify.
+        if (!std::isfinite(value)) {
+            out += "null";
+            return;
+        }
+        char buf[32];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, end);
+    }
+};
+
+template <typename T>
+struct js_serializer<T, std::enable_if_t<std::is_enum_v<T>>> {
+    static void write(std::string &out, T value) {
+        write_js(out, static_cast<std::underlying_type_t<T>>(value));
+    }
+};
+
+template <> struct js_serializer<std::string_view> {
+    static void write(std::string &out, std::string_view value) {
+        write_js_string(out, value);
+    }
+};
+
+template <> struct js_serializer<std::string> {
+    static void write(std::string &out, const std::string &value) {
+        write_js_string(out, value);
+    }
+};
+
+template <> struct js_serializer<const char *> {
+    static void write(std::string &out, const char *value) {
+        if (value) {
+            write_js_string(out, value);
+        } else {
+            out += "null";
+        }
+    }
+};
+
+template <> struct js_serializer<char *> : js_serializer<const char *> {};
+
+template <std::size_t N>
+struct js_serializer<char[N]> : js_serializer<std::string_view> {};
+
+template <typename T> struct js_serializer<std::vector<T>> {
+    static void write(std::string &out, const std::vector<T> &value) {
+        out += '[';
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (i) {
+                out += ',';
+            }
+            write_js(out, value[i]);
+        }
+        out += ']';
+    }
+};
+
+template <typename T> struct js_serializer<std::span<const T>> {
+    static void write(std::string &out, std::span<const T> value) {
+        out += '[';
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (i) {
+                out += ',';
+            }
+            write_js(out, value[i]);
+        }
+        out += ']';
+    }
+};
+
+template <typename A, typename B> struct js_serializer<std::pair<A, B>> {
+    static void write(std::string &out, const std::pair<A, B> &value) {
+        out += '[';
+        write_js(out, value.first);
+        out += ',';
+        write_js(out, value.second);
+        out += ']';
+    }
+};
+
+// Tuples (including those of references made by std::tie) are arrays.
+template <typename... Ts> struct js_serializer<std::tuple<Ts...>> {
+    static void write(std::string &out, const std::tuple<Ts...> &value) {
+        out += '[';
+        std::apply(
+            [&out](const auto &...elements) {
+                std::size_t i = 0;
+                ((out += (i++ ? "," : ""), write_js(out, elements)), ...);
+            },
+            value);
+        out += ']';
+    }
+};
+
+template <typename... Ts> struct js_serializer<std::variant<Ts...>> {
+    static void write(std::string &out, const std::variant<Ts...> &value) {
+        std::visit([&out](const auto &v) { write_js(out, v); }, value);
+    }
+};
+
+// Comma-separated arguments of a JS function call.
+inline void write_js_args(std::string &) {}
+
+template <typename T, typename... Rest>
+inline void write_js_args(std::string &out, const T &first,
+                          const Rest &...rest) {
+    write_js(out, first);
+    ((out += ',', write_js(out, rest)), ...);
+}
+
+// Writes {"key":value,...} field by field, for objects whose set of fields
+// is decided at runtime.
+class js_object_writer {
+  public:
+    explicit js_object_writer(std::string &out) : out_(out) { out_ += '{'; }
+    ~js_object_writer() { out_ += '}'; }
+    js_object_writer(const js_object_writer &) = delete;
+    js_object_writer &operator=(const js_object_writer &) = delete;
+
+    template <typename T> void field(std::string_view key, const T &value) {
+        if (!empty_) {
+            out_ += ',';
+        }
+        empty_ = false;
+        write_js_string(out_, key);
+        out_ += ':';
+        write_js(out_, value);
+    }
+
+  private:
+    std::string &out_;
+    bool empty_ = true;
+};
+} // namespace candidate_window
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Objects of one type carved out of blocks of N and recycled through a free
+// list, so that steady traffic doesn't allocate. The lock is held only to
+// pop or push a slot. All objects must be destroyed before the slab.
+template <typename T, std::size_t N = 32> class Slab {
+  public:
+    template <typename... Args> T *create(Args &&...args) {
+        Slot *slot;
+        {
+            std::lock_guard g(m_);
+            if (!free_) {
+                grow();
+            }
+            slot = free_;
+            free_ = slot->next;
+            ++live_;
+        }
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *object) {
+        object->~T();
+        auto slot = reinterpret_cast<Slot *>(object);
+        std::lock_guard g(m_);
+        slot->next = free_;
+        free_ = slot;
+        --live_;
+    }
+
+    // Objects created and not yet destroyed.
+    std::size_t live() {
+        std::lock_guard g(m_);
+        return live_;
+    }
+
+  private:
+    union Slot {
+        Slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::mutex m_;
+    Slot *free_ = nullptr;
+    std::vector<std::unique_ptr<Slot[]>> blocks_;
+    std::size_t live_ = 0;
+
+    void grow() {
+        auto block = std::make_unique<Slot[]>(N);
+        for (std::size_t i = N; i-- > 0;) {
+            block[i].next = free_;
+            free_ = &block[i];
+        }
+        blocks_.push_back(std::move(block));
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "latency.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace candidate_window {
+// A compact binary log of a session with the candidate window: its public
+// calls and calls from its page, so that a session can be replayed as a
+// benchmark.
+//
+// A trace starts with kTraceMagic and a version byte. Each record is the
+// time since the previous record in microseconds and its kind, followed by
+// its arguments. Integers are varints (zigzag if signed), doubles are 8
+// bytes little endian, and strings and vectors are prefixed by length.
+inline constexpr std::string_view kTraceMagic = "WCWT";
+inline constexpr uint8_t kTraceVersion = 1;
+
+// Arguments of a record are those of the method of the same name, except
+// js_call, whose argument is the call ["name", ...args] from the page.
+enum class TraceKind : uint8_t {
+    update_input_panel,
+    set_candidates,
+    set_layout,
+    set_writing_mode,
+    set_paging_buttons,
+    show,
+    hide,
+    scroll_key_action,
+    set_style,
+    set_theme,
+    js_call,
+};
+
+// Specialize trace_codec for new types. read consumes value from the front
+// of in, and returns false if it's truncated or malformed.
+template <typename T, typename Enable = void> struct trace_codec;
+
+template <typename T> inline void write_trace(std::string &out, const T &v) {
+    trace_codec<T>::write(out, v);
+}
+
+template <typename T> inline bool read_trace(std::string_view &in, T &v) {
+    return trace_codec<T>::read(in, v);
+}
+
+template <> struct trace_codec<uint64_t> {
+    static void write(std::string &out, uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+    static bool read(std::string_view &in, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+            auto byte = static_cast<uint8_t>(in.front());
+            in.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Other integers and enums, through uint64_t.
+template <typename T>
+struct trace_codec<T, std::enable_if_t<(std::is_integral_v<T> ||
+                                        std::is_enum_v<T>) &&
+                                       !std::is_same_v<T, uint64_t>>> {
+    static void write(std::string &out, T value) {
+        if constexpr (std::is_enum_v<T>) {
+            write_trace(out, static_cast<uint64_t>(value));
+        } else if constexpr (std::is_signed_v<T>) {
+            auto v = static_cast<int64_t>(value);
+            write_trace(out, (static_cast<uint64_t>(v) << 1) ^
+                                 static_cast<uint64_t>(v >> 63));
+        } else {
+            write_trace(out, static_cast<uint64_t>(value));
+        }
+    }
+    static bool read(std::string_view &in, T &value) {
+        uint64_t v;
+        if (!read_trace(in, v)) {
+            return false;
+        }
+        if constexpr (std::is_signed_v<T> && !std::is_enum_v<T>) {
+            value = static_cast<T>(static_cast<int64_t>(v >> 1) ^
+                                   -static_cast<int64_t>(v & 1));
+        } else {
+            value = static_cast<T>(v);
+        }
+        return true;
+    }
+};
+
+template <> struct trace_codec<double> {
+    static void write(std::string &out, double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        for (int i = 0; i < 8; ++i) {
+            out += static_cast<char>(bits >> (8 * i));
+        }
+    }
+    static bool read(std::string_view &in, double &value) {
+        if (in.size() < 8) {
+            return false;
+        }
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            bits |= static_cast<uint64_t>(static_cast<uint8_t>(in[i]))
+                    << (8 * i);
+        }
+        in.remove_prefix(8);
+        std::memcpy(&value, &bits, sizeof value);
+        return true;
+    }
+};
+
+template <> struct trace_codec<std::string_view> {
+    static void write(std::string &out, std::string_view value) {
+        write_trace(out, static_cast<uint64_t>(value.size()));
+        out += value;
+    }
+};
+
+// Written from std::string_view, and read into std::string.
+template <> struct trace_codec<std::string> {
+    static void write(std::string &out, const std::string &value) {
+        write_trace(out, std::string_view(value));
+    }
+    static bool read(std::string_view &in, std::string &value) {
+        uint64_t size;
+        if (!read_trace(in, size) || size > in.size()) {
+            return false;
+        }
+        value.assign(in.substr(0, size));
+        in.remove_prefix(size);
+        return true;
+    }
+};
+
+template <typename T> struct trace_codec<std::vector<T>> {
+    static void write(std::string &out, const std::vector<T> &value) {
+        write_trace(out, static_cast<uint64_t>(value.size()));
+        for (const auto &v : value) {
+            write_trace(out, v);
+        }
+    }
+    static bool read(std::string_view &in, std::vector<T> &value) {
+        uint64_t size;
+        // Each element takes at least a byte.
+        if (!read_trace(in, size) || size > in.size()) {
+            return false;
+        }
+        value.resize(size);
+        for (auto &v : value) {
+            if (!read_trace(in, v)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename A, typename B> struct trace_codec<std::pair<A, B>> {
+    static void write(std::string &out, const std::pair<A, B> &value) {
+        write_trace(out, value.first);
+        write_trace(out, value.second);
+    }
+    static bool read(std::string_view &in, std::pair<A, B> &value) {
+        return read_trace(in, value.first) && read_trace(in, value.second);
+    }
+};
+
+// Appends records to a file. Any thread; records are buffered and written
+// in order of the calls.
+class TraceWriter {
+  public:
+    ~TraceWriter() { close(); }
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const { return open_.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    void write(TraceKind kind, const Args &...args) {
+        if (!is_open()) {
+            return;
+        }
+        std::lock_guard g(mutex_);
+        if (!file_.is_open()) {
+            return;
+        }
+        auto now = latency_clock::now();
+        write_trace(buffer_,
+                    static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                            now - last_)
+                            .count()));
+        last_ = now;
+        write_trace(buffer_, kind);
+        (write_trace(buffer_, args), ...);
+        if (buffer_.size() >= kFlushSize) {
+            flush();
+        }
+    }
+
+  private:
+    static constexpr size_t kFlushSize = 64 << 10;
+    std::atomic<bool> open_ = false;
+    std::mutex mutex_;
+    std::ofstream file_;
+    std::string buffer_;
+    latency_clock::time_point last_;
+
+    void flush();
+};
+
+// Reads records of a whole trace in memory.
+class TraceReader {
+  public:
+    // False if the file can't be read or isn't a trace of this version.
+    bool open(const std::string &path);
+    // Header of the next record, whose arguments are then read in order.
+    // False at the end of the trace.
+    bool next(uint64_t &delay_us, TraceKind &kind);
+    template <typename T> bool read(T &value) { return read_trace(in_, value); }
+
+  private:
+    std::string data_;
+    std::string_view in_;
+};
+} // namespace candidate_window
@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <utility>
 
@@ -50,13 +51,16 @@ template <typename T> function_traits<T> make_function_traits(const T &) {
 }
 
 std::string base64(const std::string &s);
+// Length of the longest prefix of s that doesn't end in the middle of a UTF-8
+// sequence, so that a stream can be split there.
+size_t utf8_complete_length(std::string_view s);
 
 #ifndef __EMSCRIPTEN__
 #include "webview.h"
 namespace candidate_window {
-template <typename T> T *unwrap_webview_handle(webview::result<void *> handle) {
-    handle.ensure_ok();
-    return static_cast<T *>(handle.value());
+// handle is from Bridge, null if headless.
+template <typename T> T *unwrap_webview_handle(void *handle) {
+    return static_cast<T *>(handle);
 }
 } // namespace candidate_window
 #endif
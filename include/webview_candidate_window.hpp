@@ -1,5 +1,11 @@
 #pragma once
 
+#include "bridge.hpp"
+#include "deserializer.hpp"
+#include "latency.hpp"
+#include "mailbox.hpp"
+#include "serializer.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -7,13 +13,21 @@
 #include "webview.h"
 #include <thread>
 #endif
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <nlohmann/json.hpp>
-#include <sstream>
+#include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace candidate_window {
@@ -67,6 +81,8 @@ enum scroll_key_action_t {
 struct CandidateAction {
     int id;
     std::string text;
+
+    bool operator==(const CandidateAction &) const = default;
 };
 
 struct Candidate {
@@ -75,23 +91,231 @@ struct Candidate {
     std::string comment;
     std::vector<CandidateAction> actions;
     bool spaceBetweenComment = true;
+
+    bool operator==(const Candidate &) const = default;
 };
 
 void to_json(nlohmann::json &j, const CandidateAction &a);
 void to_json(nlohmann::json &j, const Candidate &c);
 
+template <> struct js_serializer<CandidateAction> {
+    static void write(std::string &out, const CandidateAction &a) {
+        js_object_writer o(out);
+        o.field("id", a.id);
+        o.field("text", a.text);
+    }
+};
+
+template <> struct js_serializer<Candidate> {
+    static void write(std::string &out, const Candidate &c) {
+        js_object_writer o(out);
+        o.field("text", c.text);
+        o.field("label", c.label);
+        o.field("comment", c.comment);
+        o.field("actions", c.actions);
+        o.field("spaceBetweenComment", c.spaceBetweenComment);
+    }
+};
+
+template <> struct trace_codec<CandidateAction> {
+    static void write(std::string &out, const CandidateAction &a) {
+        write_trace(out, a.id);
+        write_trace(out, a.text);
+    }
+    static bool read(std::string_view &in, CandidateAction &a) {
+        return read_trace(in, a.id) && read_trace(in, a.text);
+    }
+};
+
+template <> struct trace_codec<Candidate> {
+    static void write(std::string &out, const Candidate &c) {
+        write_trace(out, c.text);
+        write_trace(out, c.label);
+        write_trace(out, c.comment);
+        write_trace(out, c.actions);
+        write_trace(out, c.spaceBetweenComment);
+    }
+    static bool read(std::string_view &in, Candidate &c) {
+        return read_trace(in, c.text) && read_trace(in, c.label) &&
+               read_trace(in, c.comment) && read_trace(in, c.actions) &&
+               read_trace(in, c.spaceBetweenComment);
+    }
+};
+
+enum class panel_field_t {
+    layout,
+    writing_mode,
+    preedit,
+    aux,
+    candidates,
+    paging,
+    count
+};
+constexpr size_t kPanelFieldCount = static_cast<size_t>(panel_field_t::count);
+
+// Panel state set by the engine. Setters bump the generation of the field
+// they change, so that readers can tell what changed since they last looked.
+struct PanelState {
+    layout_t layout = layout_t::horizontal;
+    writing_mode_t writing_mode = writing_mode_t::horizontal_tb;
+    formatted preedit_pre_caret;
+    bool has_caret = false;
+    formatted preedit_post_caret;
+    formatted aux_up;
+    formatted aux_down;
+    std::vector<Candidate> candidates;
+    int highlighted = -1;
+    scroll_state_t scroll_state = scroll_state_t::none;
+    bool scroll_start = false;
+    bool scroll_end = false;
+    bool pageable = false;
+    bool has_prev = false;
+    bool has_next = false;
+    uint32_t generation[kPanelFieldCount] = {};
+
+    void touch(panel_field_t field) {
+        ++generation[static_cast<size_t>(field)];
+    }
+
+    // Copy only the fields that are stale compared with other.
+    void update_from(const PanelState &other) {
+        auto stale = [&](panel_field_t field) {
+            auto i = static_cast<size_t>(field);
+            return generation[i] != other.generation[i];
+        };
+        if (stale(panel_field_t::layout)) {
+            layout = other.layout;
+        }
+        if (stale(panel_field_t::writing_mode)) {
+            writing_mode = other.writing_mode;
+        }
+        if (stale(panel_field_t::preedit)) {
+            preedit_pre_caret = other.preedit_pre_caret;
+            has_caret = other.has_caret;
+            preedit_post_caret = other.preedit_post_caret;
+        }
+        if (stale(panel_field_t::aux)) {
+            aux_up = other.aux_up;
+            aux_down = other.aux_down;
+        }
+        if (stale(panel_field_t::candidates)) {
+            candidates = other.candidates;
+            highlighted = other.highlighted;
+            scroll_state = other.scroll_state;
+            scroll_start = other.scroll_start;
+            scroll_end = other.scroll_end;
+        }
+        if (stale(panel_field_t::paging)) {
+            pageable = other.pageable;
+            has_prev = other.has_prev;
+            has_next = other.has_next;
+        }
+        std::copy(std::begin(other.generation), std::end(other.generation),
+                  std::begin(generation));
+    }
+};
+
 enum CustomAPI : uint64_t { kCurl = 1 };
 
-extern std::unordered_map<std::string,
-                          std::function<std::string(const nlohmann::json &)>>
-    handlers;
-std::string call_handler(std::string s);
+// Handler of a JS call, given its arguments.
+using handler_t =
+    std::function<std::string(std::span<const std::string_view> args)>;
+
+// Handlers of JS calls to one page, so that windows in the same process
+// don't take over each other's. Handlers are stored by opcode, which is the
+// order of registration. Rebinding a name keeps its opcode.
+class HandlerRegistry {
+  public:
+    uint16_t add(const std::string &name, handler_t handler);
+    // Calls to name are then unknown. Its opcode is kept for a later add.
+    void remove(std::string_view name);
+    // Dispatch a call ["name" or opcode, ...args] from JS.
+    std::string call(std::string_view s);
+
+  private:
+    std::vector<handler_t> handlers_; // Indexed by opcode.
+    std::map<std::string, uint16_t, std::less<>> opcodes_;
+    // Slices of arguments, reused across calls.
+    std::vector<std::string_view> buffer_;
+
+    std::string dispatch(std::string_view s,
+                         std::vector<std::string_view> &args);
+};
+
+template <typename Tuple, size_t... Is>
+bool read_js_args([[maybe_unused]] std::span<const std::string_view> args,
+                  [[maybe_unused]] Tuple &tuple, std::index_sequence<Is...>) {
+    return (read_js(args[Is], std::get<Is>(tuple)) && ...);
+}
+
+// Wrap f so that it's called with arguments decoded from their JSON slices.
+template <typename F> handler_t make_handler(const std::string &name, F f) {
+    using Ret = typename function_traits<F>::return_type;
+    using ArgsTp = typename function_traits<F>::args_tuple;
+    constexpr size_t arity = std::tuple_size_v<ArgsTp>;
+    return [=](std::span<const std::string_view> j) -> std::string {
+        if (arity > j.size()) {
+            std::cerr << "[JS] Insufficient number of arguments of '" << name
+                      << "', needed " << arity << ", got " << j.size()
+                      << std::endl;
+            return "";
+        }
+        ArgsTp args;
+        if (!read_js_args(j, args, std::make_index_sequence<arity>{})) {
+            // No access to fcitx logging; print to stderr.
+            std::cerr << "[JS] Invalid arguments of '" << name << "'"
+                      << std::endl;
+            return "";
+        }
+        if constexpr (std::is_void_v<Ret>) {
+            std::apply(f, args);
+            return "";
+        } else {
+            auto ret = std::apply(f, args);
+            return nlohmann::json(ret).dump();
+        }
+    };
+}
+
+struct CurlStream;
+
+// Counters of scripts sent to webview, for measuring bridge cost per frame.
+struct BridgeStats {
+    uint64_t evals = 0;  // Number of scripts evaluated.
+    uint64_t bytes = 0;  // Total length of scripts evaluated.
+    uint64_t frames = 0; // Number of show() calls.
+};
+
+// Resident memory in bytes.
+struct MemoryUsage {
+    size_t ui_process = 0;
+    // WebKit's web and network processes started by this one. Each window
+    // has its own web process, and all share the network process. Other
+    // child processes are left out. Linux only.
+    size_t web_processes = 0;
+};
+
+// Keeps memory of an input method that runs for weeks flat. Linux only.
+struct MemoryPolicy {
+    // Release memory once the panel has been hidden this long. Zero
+    // disables.
+    std::chrono::milliseconds idle_release{0};
+    // Release memory on hide() if usage of all processes exceeds this many
+    // bytes, checked at most every few seconds. Zero disables.
+    size_t soft_budget = 0;
+};
 
 // User of this class should ensure no concurrent calls from different threads.
 class WebviewCandidateWindow {
   public:
     // Below are required to be called from main thread.
     WebviewCandidateWindow(std::function<void()> init_callback);
+#ifndef __EMSCRIPTEN__
+    // Talk to the page through bridge, and skip native window if it's not
+    // null, e.g. to drive a StubBridge headlessly.
+    WebviewCandidateWindow(std::unique_ptr<Bridge> bridge,
+                           std::function<void()> init_callback);
+#endif
     ~WebviewCandidateWindow();
     void scroll_key_action(scroll_key_action_t action) const;
     void answer_actions(const std::vector<CandidateAction> &actions) const;
@@ -109,21 +333,54 @@ class WebviewCandidateWindow {
     void apply_app_accent_color(const std::string &color);
     void set_accent_color() const;
     void copy_html() const;
+    // Render representative candidates in every layout and writing mode
+    // without showing them, so that the first show() doesn't wait for JIT,
+    // style resolution and font fallback. Deferred until the page is loaded.
+    // done runs when it's finished, or skipped because the panel is shown.
+    void prewarm(std::function<void()> done = [] {});
+
+    const BridgeStats &bridge_stats() const { return bridge_stats_; }
+    void reset_bridge_stats() { bridge_stats_ = {}; }
+    // Latency of bridge calls and of show() until the window is resized.
+    const LatencyStats &latency_stats() const { return latency_stats_; }
+    void reset_latency_stats() { latency_stats_ = {}; }
+    std::string dump_latency_stats() const;
+
+    MemoryUsage memory_usage() const;
+    // Any policy but the default one also makes WebKit cache as little as
+    // for a single document. It's shared by all windows in the process.
+    void set_memory_policy(MemoryPolicy policy);
+    // Drop what the hidden panel shows, WebKit's caches and JS garbage, e.g.
+    // on system memory pressure. No-op while shown.
+    void release_memory() const;
+
+    // Log public calls below and calls from the page to a trace at path, for
+    // preview/replay to play back. Replaces a recording in progress.
+    bool start_recording(const std::string &path);
+    void stop_recording();
+    // Handle a call ["name", ...args] from the page.
+    std::string call_from_page(std::string_view call);
 
 #ifndef __EMSCRIPTEN__
     void set_api(uint64_t apis);
+    // Cache responses of the curl API in memory up to capacity bytes, and in
+    // file at path across restarts if it's not empty.
+    void set_curl_cache(size_t capacity, const std::string &path = "");
     void load_plugins(const std::vector<std::string> &names);
     void unload_plugins();
 #endif
 
-    // Below are allowed to be called from any thread.
+    // Below are allowed to be called from any thread, one thread at a time.
+    // Each call publishes a snapshot of panel state without blocking, and
+    // show() renders the newest one.
     void update_input_panel(formatted preedit, int caret, formatted auxUp,
                             formatted auxDown);
     void set_candidates(std::vector<Candidate> candidates, int highlighted,
                         scroll_state_t scroll_state, bool scroll_start,
                         bool scroll_end);
-    void set_layout(layout_t layout) { layout_ = layout; }
-    void set_writing_mode(writing_mode_t mode) { writing_mode_ = mode; }
+    void set_layout(layout_t layout);
+    void set_writing_mode(writing_mode_t mode);
+    void set_paging_buttons(bool pageable, bool has_prev, bool has_next);
 
     void set_select_callback(std::function<void(int index)> callback) {
         select_callback = callback;
@@ -141,12 +398,6 @@ class WebviewCandidateWindow {
         scroll_callback = callback;
     }
 
-    void set_paging_buttons(bool pageable, bool has_prev, bool has_next) {
-        pageable_ = pageable;
-        has_prev_ = has_prev;
-        has_next_ = has_next;
-    }
-
     void set_ask_actions_callback(std::function<void(int index)> callback) {
         ask_actions_callback = callback;
     }
@@ -155,13 +406,29 @@ class WebviewCandidateWindow {
         action_callback = callback;
     }
 
-    // Fetch system accent color.
+    // Fetch system accent color. Implementations bump
+    // accent_color_generation_ on change.
     void update_accent_color();
 
   private:
 #ifndef __EMSCRIPTEN__
     std::thread::id main_thread_id_;
-    std::unique_ptr<webview::webview> w_;
+#endif
+    // False if constructed with a bridge, so there is no native window.
+    bool native_ = true;
+    HandlerRegistry handlers_;
+    // Written from const methods and engine thread; locks itself.
+    mutable TraceWriter trace_;
+#ifndef __EMSCRIPTEN__
+    std::unique_ptr<Bridge> w_;
+    // Latest curl transfer of each supersede key. Main thread only.
+    std::unordered_map<std::string, uint64_t> curl_transfers_;
+    // Streamed curl responses by id given by JS. Main thread only.
+    std::unordered_map<std::string, std::shared_ptr<CurlStream>>
+        curl_streams_;
+    // Lets curl callbacks be posted through w_ while the curl API is on.
+    // Declared after w_ so that it's dropped before w_ is destroyed.
+    std::shared_ptr<void> curl_registration_;
 #endif
     mutable double caret_x_ = 0;
     mutable double caret_y_ = 0;
@@ -170,24 +437,66 @@ class WebviewCandidateWindow {
     double y_ = 0;
     mutable bool hidden_ = true;
     bool was_above_ = false;
+    MemoryPolicy memory_policy_;
+    mutable unsigned idle_release_source_ = 0; // GLib source on Linux.
+    mutable latency_clock::time_point budget_checked_;
+    // Last frame (x, y, width, height) and input shape (top, right, bottom,
+    // left and 4 corner radii of panel) applied to native window, so that
+    // unchanged ones are not requested again.
+    std::optional<std::array<int, 4>> applied_frame_;
+    std::optional<std::array<int, 8>> applied_shape_;
     bool accent_color_nil_ = false;
     // Fallback to macOS default blue on platforms with no accent color support.
     int accent_color_ = 4;
     std::string app_accent_color_ = "";
-    layout_t layout_ = layout_t::horizontal;
-    writing_mode_t writing_mode_ = writing_mode_t::horizontal_tb;
-    formatted preeditPreCaret_;
-    bool hasCaret_ = false;
-    formatted preeditPostCaret_;
-    formatted auxUp_;
-    formatted auxDown_;
-    std::vector<Candidate> candidates_;
-    int highlighted_ = -1;
-    scroll_state_t scroll_state_;
-    bool scroll_start_;
-    bool scroll_end_;
+    uint32_t accent_color_generation_ = 0;
+    mutable uint32_t sent_accent_color_generation_ = 0;
+    // Of the style blob last sent, so that reloading config or switching to
+    // an app with the same style doesn't make the page apply it again.
+    mutable std::optional<size_t> sent_style_hash_;
+    // Written by the setters' thread, and published to main thread.
+    PanelState staging_;
+    mutable Mailbox<PanelState> mailbox_;
+    // Guards pickups dispatched to main loop against destruction.
+    std::shared_ptr<int> alive_ = std::make_shared<int>(0);
+    void publish();
+    // Main thread only. Newest state picked up from the mailbox.
+    const PanelState &panel_state() const { return mailbox_.front(); }
     mutable uint32_t epoch = 0; // A timestamp for async results from
                                 // webview
+    mutable BridgeStats bridge_stats_;
+    mutable LatencyStats latency_stats_;
+    mutable latency_clock::time_point show_time_;
+    latency_clock::time_point create_time_ = latency_clock::now();
+    uint32_t measured_epoch_ = 0; // Only the first resize of an epoch counts.
+    bool loaded_ = false;
+    bool prewarm_pending_ = false; // Called before the page was loaded.
+    std::function<void()> prewarm_done_;
+
+    // show() sends only fields whose generation differs from the one last
+    // sent.
+    mutable uint32_t sent_generation_[kPanelFieldCount] = {};
+    bool dirty(panel_field_t field) const {
+        auto i = static_cast<size_t>(field);
+        return sent_generation_[i] != panel_state().generation[i];
+    }
+    void mark_dirty(panel_field_t field) const {
+        auto i = static_cast<size_t>(field);
+        sent_generation_[i] = panel_state().generation[i] - 1;
+    }
+
+    // What the page last rendered by a full setCandidates, so that show() can
+    // send only the difference when nothing structural changed.
+    mutable std::vector<Candidate> sent_candidates_;
+    mutable bool candidates_synced_ = false;
+    mutable layout_t sent_layout_ = layout_t::horizontal;
+    mutable bool sent_pageable_ = false;
+    mutable int sent_highlighted_ = -1;
+    mutable bool sent_has_prev_ = false;
+    mutable bool sent_has_next_ = false;
+    // Candidates sent in scrolling state, of which the page renders only rows
+    // in view, and fetches others again by scrollRange.
+    mutable std::vector<Candidate> scroll_candidates_;
 
   private:
     std::function<void(int index)> select_callback = [](int) {};
@@ -198,9 +507,6 @@ class WebviewCandidateWindow {
     std::function<void(int index, int id)> action_callback = [](int, int) {};
     std::string system_ = "";
     int version_ = 0;
-    bool pageable_ = false;
-    bool has_prev_ = false;
-    bool has_next_ = false;
 
     /* Platform-specific interfaces (implemented in 'platform') */
     void *create_window();
@@ -216,85 +522,88 @@ class WebviewCandidateWindow {
 
     void *platform_data = nullptr;
     void platform_init();
+    void load_page();
+    void apply_memory_policy();
+    // After hide(), release memory when memory_policy_ says.
+    void watch_memory() const;
+    void release_webkit_memory() const;
+
+    std::variant<std::nullptr_t, std::string_view, int>
+    accent_color_value() const;
+    // Called when page state is cleared or unknown (hidePanel, reload) so
+    // that next show() sends everything.
+    void invalidate_frame() const;
+    void write_candidates(js_object_writer &frame,
+                          const PanelState &state) const;
 
   private:
     /* API */
     void api_curl(std::string id, std::string req);
+    void api_curl_cancel(const std::string &key);
+    // Send what's received of a stream to JS. Unless last, a trailing
+    // partial UTF-8 sequence or base64 group is held back.
+    void flush_curl_stream(const std::string &id, CurlStream &stream,
+                           bool last);
+    void ack_curl_stream(const std::string &id, size_t bytes);
+    // JS stopped reading the stream before its end.
+    void close_curl_stream(const std::string &id);
 
   private:
     /* Invoke a JavaScript function. */
-    template <typename Ret = void, typename... Args>
-    inline Ret invoke_js(const char *name, Args... args) const {
-        std::stringstream ss;
+    template <typename... Args>
+    inline void invoke_js(const char *name, const Args &...args) const {
+        invoke_js_with(name,
+                       [&](std::string &out) { write_js_args(out, args...); });
+    }
+
+    // Like invoke_js, but write_args writes the arguments into the script.
+    template <typename F>
+    void invoke_js_with(const char *name, F &&write_args) const {
+        // Reuse the buffer across calls. Swap it out so that a nested call
+        // (JS calling back into C++ synchronously) gets its own.
+        auto start = latency_clock::now();
+        std::string s;
+        s.swap(js_buffer_);
+        s.clear();
 #ifdef __EMSCRIPTEN__
-        ss << "[";
-        build_js_args(ss, args...);
-        ss << "]";
-        auto s = ss.str();
+        s += '[';
+        write_args(s);
+        s += ']';
+        bridge_stats_.evals += 1;
+        bridge_stats_.bytes += s.size();
         EM_ASM(fcitx.invoke(UTF8ToString($0), UTF8ToString($1)), name,
                s.c_str());
 #else
-        ss << "fcitx." << name << "(";
-        build_js_args(ss, args...);
-        ss << ");";
-        auto s = ss.str();
+        s += "fcitx.";
+        s += name;
+        s += '(';
+        write_args(s);
+        s += ");";
         assert(std::this_thread::get_id() == main_thread_id_ &&
                "invoke_js must be called from main thread");
+        bridge_stats_.evals += 1;
+        bridge_stats_.bytes += s.size();
         w_->eval(s);
 #endif
+        js_buffer_.swap(s);
+        latency_stats_.record("invoke_js", latency_stats_.invoke_js, name,
+                              epoch, start, latency_clock::now());
     }
 
-    template <typename T>
-    inline void build_js_args(std::stringstream &ss, const T &arg) const {
-        ss << nlohmann::json(arg).dump();
-    }
-
-    template <typename T, typename... Rest>
-    inline void build_js_args(std::stringstream &ss, const T &arg,
-                              const Rest &...rest) const {
-        build_js_args(ss, arg);
-        ss << ", ";
-        build_js_args(ss, rest...);
-    }
-
-    inline void build_js_args(std::stringstream &ss) const {}
+    mutable std::string js_buffer_;
 
   private:
     /* Generic bind */
     template <typename F> inline void bind(const std::string &name, F f) {
-        using Ret = typename function_traits<F>::return_type;
-        using ArgsTp = typename function_traits<F>::args_tuple;
-        auto handler = [=, this](const nlohmann::json &j) -> std::string {
-            ArgsTp args;
-            if (std::tuple_size<ArgsTp>() > j.size()) {
-                std::cerr << "[JS] Insufficient number of arguments of '"
-                          << name << "', needed " << std::tuple_size<ArgsTp>()
-                          << ", got " << j.size() << std::endl;
-                return "";
-            }
-            try {
-                args = json_to_tuple<ArgsTp>(
-                    j, std::make_index_sequence<std::tuple_size_v<ArgsTp>>{});
-            } catch (const std::exception &e) {
-                // No access to fcitx logging; print to stderr.
-                std::cerr << "[JS] Error running '" << name << "': " << e.what()
-                          << std::endl;
-                return "";
-            }
-            if constexpr (std::is_void_v<Ret>) {
-                std::apply(f, args);
-                return "";
-            } else {
-                auto ret = std::apply(f, args);
-                return nlohmann::json(ret).dump();
-            }
-        };
-        handlers[name] = handler;
-    }
-
-    template <typename Tuple, size_t... Is>
-    Tuple json_to_tuple(const nlohmann::json &j, std::index_sequence<Is...>) {
-        return {j[Is].get<typename std::tuple_element<Is, Tuple>::type>()...};
+        handlers_.add(
+            name, [this, name, handler = make_handler(name, std::move(f))](
+                      std::span<const std::string_view> args) {
+                auto start = latency_clock::now();
+                auto ret = handler(args);
+                latency_stats_.record("handler", latency_stats_.handlers, name,
+                                      epoch, start, latency_clock::now());
+                return ret;
+            });
     }
 };
 
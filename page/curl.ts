@@ -0,0 +1,90 @@
+import { SseParser } from './sse'
+
+interface StreamState {
+  chunks: [chunk: string, bytes: number][]
+  wake: (() => void) | null
+}
+
+const streams = new Map<string, StreamState>()
+let lastStream = 0
+
+// Called by C++ with a piece of the body and its size before base64.
+function curlChunk(id: string, chunk: string, bytes: number) {
+  const stream = streams.get(id)
+  if (!stream) {
+    return
+  }
+  stream.chunks.push([chunk, bytes])
+  stream.wake?.()
+}
+
+// Abort the unfinished request with this supersede key.
+function curlCancel(key: string) {
+  if (!window.curl) {
+    throw new Error('curl API is not enabled')
+  }
+  window.fcitx('curlCancel', key)
+}
+
+// Iterate the body of a response as it arrives, as strings (base64 if
+// args.binary) or as parsed events if args.sse. C++ stops reading from the
+// network while too much is not yet consumed by the iteration.
+function curlStream(url: string, args: CurlStreamArgs = {}): CurlStream {
+  if (!window.curl) {
+    throw new Error('curl API is not enabled')
+  }
+  const id = String(++lastStream)
+  const state: StreamState = { chunks: [], wake: null }
+  streams.set(id, state)
+  let settled = false
+  const { sse, ...rest } = args
+  // C++ settles it after the last chunk.
+  const response = window.curl(url, { ...rest, stream: id }).finally(() => {
+    settled = true
+    state.wake?.()
+  })
+  // Rejection is rethrown by the iteration.
+  response.catch(() => {})
+  const parser = sse ? new SseParser() : null
+
+  async function* iterate() {
+    try {
+      while (true) {
+        const next = state.chunks.shift()
+        if (next) {
+          const [chunk, bytes] = next
+          window.fcitx('curlAck', id, bytes)
+          if (parser) {
+            yield* parser.feed(chunk)
+          }
+          else {
+            yield chunk
+          }
+          continue
+        }
+        if (settled) {
+          break
+        }
+        await new Promise<void>((resolve) => {
+          state.wake = resolve
+        })
+        state.wake = null
+      }
+      await response
+    }
+    finally {
+      streams.delete(id)
+      if (!settled) {
+        // The loop was broken out of.
+        window.fcitx('curlClose', id)
+      }
+    }
+  }
+  return Object.assign(iterate(), { response })
+}
+
+export {
+  curlCancel,
+  curlChunk,
+  curlStream,
+}
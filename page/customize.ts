@@ -3,6 +3,7 @@ import { setCaretText, setHighlightMarkText } from './panel'
 import { setAnimation, setScrollParams } from './scroll'
 import { theme } from './selector'
 import {
+  invalidateStyleMetrics,
   setBlink,
   setBlur,
   setHoverBehavior,
@@ -13,6 +14,27 @@ function px(n: string | number) {
   return `${n}px`
 }
 
+// What setStyle last set on theme, so that applying a style touches only what changed,
+// and switching between styles that share most values doesn't restyle the whole panel.
+const appliedProperties = new Map<string, string>()
+let styleChanged = false
+
+function setProperty(name: string, value: string) {
+  if (appliedProperties.get(name) === value) {
+    return
+  }
+  appliedProperties.set(name, value)
+  theme.style.setProperty(name, value)
+  styleChanged = true
+}
+
+function setClass(klass: string, enabled: boolean) {
+  if (theme.classList.contains(klass) !== enabled) {
+    theme.classList.toggle(klass, enabled)
+    styleChanged = true
+  }
+}
+
 const genericFontFamilies = [
   'cursive',
   'fangsong',
@@ -42,11 +64,20 @@ function setFontFamily(name: string, f: FONT_FAMILY) {
     }
     return JSON.stringify(s)
   })
-  theme.style.setProperty(name, fontFamily.join(', '))
+  setProperty(name, fontFamily.join(', '))
 }
 
+// A local file may have been edited since WebKit cached it, so it's loaded once per page with a
+// random query. The URL stays the same afterwards, so switching back to a style costs no reload.
+const cacheBusters = new Map<string, string>()
+
 function noCache(url: string): string {
-  return `${url}?r=${Math.random()}`
+  let buster = cacheBusters.get(url)
+  if (!buster) {
+    buster = `${url}?r=${Math.random()}`
+    cacheBusters.set(url, buster)
+  }
+  return buster
 }
 
 const allSystemClasses = ['macos']
@@ -70,22 +101,10 @@ function setDefaultTheme(defaultTheme: DEFAULT_THEME) {
       break
   }
   for (const c of allSystemClasses) {
-    const klass = `fcitx-${c}`
-    if (c === systemClass) {
-      theme.classList.add(klass)
-    }
-    else {
-      theme.classList.remove(klass)
-    }
+    setClass(`fcitx-${c}`, c === systemClass)
   }
   for (const c of allVersionClasses) {
-    const klass = `fcitx-${c}`
-    if (c === versionClass) {
-      theme.classList.add(klass)
-    }
-    else {
-      theme.classList.remove(klass)
-    }
+    setClass(`fcitx-${c}`, c === versionClass)
   }
 }
 
@@ -93,6 +112,7 @@ const ACCENT_COLOR = 'var(--accent-color)'
 
 export function setStyle(style: string) {
   const j = JSON.parse(style) as STYLE_JSON
+  styleChanged = false
 
   let backgroundImage = j.Background.ImageUrl.trim()
   if (backgroundImage.startsWith('fcitx://')) {
@@ -100,14 +120,14 @@ export function setStyle(style: string) {
   }
 
   function setColor(name: string, property: keyof STYLE_JSON['LightMode'] | '', fallback = '') {
-    theme.style.setProperty(`--light-${name}`, j.LightMode.OverrideDefault === 'True' && property ? j.LightMode[property] : fallback)
-    theme.style.setProperty(`--dark-${name}`, j.DarkMode.OverrideDefault === 'True' && property
+    setProperty(`--light-${name}`, j.LightMode.OverrideDefault === 'True' && property ? j.LightMode[property] : fallback)
+    setProperty(`--dark-${name}`, j.DarkMode.OverrideDefault === 'True' && property
       ? (j.DarkMode.SameWithLightMode === 'True' && j.LightMode.OverrideDefault === 'True' ? j.LightMode[property] : j.DarkMode[property])
       : fallback.replace('--light-', '--dark-'))
   }
 
   function setSize(name: string, value: number | string) {
-    theme.style.setProperty(`--${name}`, j.Size.OverrideDefault === 'True' ? px(value) : '')
+    setProperty(`--${name}`, j.Size.OverrideDefault === 'True' ? px(value) : '')
   }
 
   if (j.Basic.DefaultTheme === 'System') {
@@ -196,23 +216,23 @@ export function setStyle(style: string) {
   setSize('horizontal-divider-width', j.Size.HorizontalDividerWidth)
 
   // Typography
-  theme.style.setProperty('--vertical-comment-flex', j.Typography.VerticalCommentsAlignRight === 'True' ? '1' : '')
+  setProperty('--vertical-comment-flex', j.Typography.VerticalCommentsAlignRight === 'True' ? '1' : '')
   setPagingButtonsStyle(j.Typography.PagingButtonsStyle)
 
   // Scroll mode
   const maxRow = Number(j.ScrollMode.MaxRowCount)
   const maxColumn = Number(j.ScrollMode.MaxColumnCount)
-  theme.style.setProperty('--max-row', j.ScrollMode.MaxRowCount)
-  theme.style.setProperty('--max-column', j.ScrollMode.MaxColumnCount)
+  setProperty('--max-row', j.ScrollMode.MaxRowCount)
+  setProperty('--max-column', j.ScrollMode.MaxColumnCount)
   setScrollParams(maxRow, maxColumn, cellWidth, candidateHeight)
-  theme.style.setProperty('--scrollbar-redundancy-width', j.ScrollMode.ShowScrollBar === 'False' ? '0px' : '2px')
-  theme.style.setProperty('--scrollbar-width', j.ScrollMode.ShowScrollBar === 'False' ? '0px' : '8px')
+  setProperty('--scrollbar-redundancy-width', j.ScrollMode.ShowScrollBar === 'False' ? '0px' : '2px')
+  setProperty('--scrollbar-width', j.ScrollMode.ShowScrollBar === 'False' ? '0px' : '8px')
   const animation = j.ScrollMode.Animation === 'True'
-  theme.style.setProperty('--scroll-animation', animation ? '' : 'none')
+  setProperty('--scroll-animation', animation ? '' : 'none')
   setAnimation(animation)
 
   // Background
-  theme.style.setProperty('--background-image', backgroundImage ? `url(${JSON.stringify(backgroundImage)})` : '')
+  setProperty('--background-image', backgroundImage ? `url(${JSON.stringify(backgroundImage)})` : '')
 
   if (window.fcitx.distribution === 'fcitx5-js') {
     if (j.Background.Blur === 'True') {
@@ -222,27 +242,27 @@ export function setStyle(style: string) {
       setBlur(false)
     }
     const blur = `blur(${px(j.Background.BlurRadius!)})`
-    theme.style.setProperty('--backdrop-filter', blur)
+    setProperty('--backdrop-filter', blur)
   }
 
-  theme.style.setProperty('--panel-shadow', j.Background.Shadow === 'True' ? '' : 'none')
+  setProperty('--panel-shadow', j.Background.Shadow === 'True' ? '' : 'none')
 
   // Font
   setFontFamily('--text-font-family', j.Font.TextFontFamily)
-  theme.style.setProperty('--text-font-size', px(j.Font.TextFontSize))
-  theme.style.setProperty('--text-font-weight', j.Font.TextFontWeight)
+  setProperty('--text-font-size', px(j.Font.TextFontSize))
+  setProperty('--text-font-weight', j.Font.TextFontWeight)
 
   setFontFamily('--label-font-family', j.Font.LabelFontFamily)
-  theme.style.setProperty('--label-font-size', px(j.Font.LabelFontSize))
-  theme.style.setProperty('--label-font-weight', j.Font.LabelFontWeight)
+  setProperty('--label-font-size', px(j.Font.LabelFontSize))
+  setProperty('--label-font-weight', j.Font.LabelFontWeight)
 
   setFontFamily('--comment-font-family', j.Font.CommentFontFamily)
-  theme.style.setProperty('--comment-font-size', px(j.Font.CommentFontSize))
-  theme.style.setProperty('--comment-font-weight', j.Font.CommentFontWeight)
+  setProperty('--comment-font-size', px(j.Font.CommentFontSize))
+  setProperty('--comment-font-weight', j.Font.CommentFontWeight)
 
   setFontFamily('--preedit-font-family', j.Font.PreeditFontFamily)
-  theme.style.setProperty('--preedit-font-size', px(j.Font.PreeditFontSize))
-  theme.style.setProperty('--preedit-font-weight', j.Font.PreeditFontWeight)
+  setProperty('--preedit-font-size', px(j.Font.PreeditFontSize))
+  setProperty('--preedit-font-weight', j.Font.PreeditFontWeight)
 
   // Caret
   setBlink(j.Caret.Style === 'Blink')
@@ -250,9 +270,18 @@ export function setStyle(style: string) {
 
   // Highlight
   setHoverBehavior(j.Highlight.HoverBehavior)
-  theme.style.setProperty('--mark-opacity', j.Highlight.MarkStyle === 'None' ? '0' : '1')
+  setProperty('--mark-opacity', j.Highlight.MarkStyle === 'None' ? '0' : '1')
 
-  document.head.querySelector('#fcitx-user')?.setAttribute('href', noCache(j.Advanced.UserCss))
+  const userCss = document.head.querySelector('#fcitx-user')
+  const href = noCache(j.Advanced.UserCss)
+  if (userCss && userCss.getAttribute('href') !== href) {
+    // Style metrics are invalidated again when it's loaded.
+    userCss.setAttribute('href', href)
+    styleChanged = true
+  }
 
-  fixGhostStripe()
+  if (styleChanged) {
+    invalidateStyleMetrics()
+    fixGhostStripe()
+  }
 }
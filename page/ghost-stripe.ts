@@ -1,5 +1,5 @@
-import { hoverables, panel } from './selector'
-import { getHoverBehavior } from './ux'
+import { hoverables, panel, theme } from './selector'
+import { getHoverBehavior, getStyleGeneration } from './ux'
 
 const id = 'fcitx-ghost-stripe'
 
@@ -9,11 +9,38 @@ const id = 'fcitx-ghost-stripe'
 // It's a browser bug about anti-aliasing for long time so we can't wait for it to be fixed.
 // Scroll mode is less affected but hard to fix given candidate positions are arbitrary so we give up.
 // We also assume highlight color is opaque.
-function getClipPath(candidate: HTMLElement, panelBox: DOMRect, panelStyle: CSSStyleDeclaration): string {
-  const borderWidth = Number.parseFloat(panelStyle.borderWidth)
+interface Corners {
+  borderWidth: number
+  borderTopLeftRadius: string
+  borderTopRightRadius: string
+  borderBottomRightRadius: string
+  borderBottomLeftRadius: string
+}
+
+// Computed style is read again only when style, or classes that may select it, change.
+let cornersGeneration = -1
+const cornersCache = new Map<string, Corners>()
+
+function getCorners(element: Element, classes: string): Corners {
+  if (cornersGeneration !== getStyleGeneration()) {
+    cornersGeneration = getStyleGeneration()
+    cornersCache.clear()
+  }
+  const key = `${theme.className} ${panel.className} ${classes}`
+  let corners = cornersCache.get(key)
+  if (!corners) {
+    const { borderWidth, borderTopLeftRadius, borderTopRightRadius, borderBottomRightRadius, borderBottomLeftRadius } = getComputedStyle(element)
+    corners = { borderWidth: Number.parseFloat(borderWidth), borderTopLeftRadius, borderTopRightRadius, borderBottomRightRadius, borderBottomLeftRadius }
+    cornersCache.set(key, corners)
+  }
+  return corners
+}
+
+function getClipPath(candidate: HTMLElement, panelBox: DOMRect, panelStyle: Corners): string {
+  const { borderWidth } = panelStyle
   const inner = candidate.querySelector('.fcitx-candidate-inner') as HTMLElement
   const innerBox = inner.getBoundingClientRect()
-  const innerStyle = getComputedStyle(inner)
+  const innerStyle = getCorners(inner, `${candidate.className} ${inner.className}`)
   const tl = innerBox.top <= panelBox.top + borderWidth && innerBox.left <= panelBox.left + borderWidth && Number.parseFloat(innerStyle.borderTopLeftRadius) <= Number.parseFloat(panelStyle.borderTopLeftRadius)
   const tr = innerBox.top <= panelBox.top + borderWidth && innerBox.right >= panelBox.right - borderWidth && Number.parseFloat(innerStyle.borderTopRightRadius) <= Number.parseFloat(panelStyle.borderTopRightRadius)
   const bl = innerBox.bottom >= panelBox.bottom - borderWidth && innerBox.left <= panelBox.left + borderWidth && Number.parseFloat(innerStyle.borderBottomLeftRadius) <= Number.parseFloat(panelStyle.borderBottomLeftRadius)
@@ -60,7 +87,7 @@ export function fixGhostStripe() {
       break
     }
     const panelBox = panel.getBoundingClientRect()
-    const panelStyle = getComputedStyle(panel)
+    const panelStyle = getCorners(panel, '')
     const firstClipPath = getClipPath(candidates[0], panelBox, panelStyle)
     const lastClipPath = candidates.length > 1 ? getClipPath(candidates[candidates.length - 1], panelBox, panelStyle) : ''
     if (!firstClipPath && !lastClipPath) {
@@ -120,6 +120,36 @@ declare global {
   type SCROLL_MOVE_HIGHLIGHT = typeof UP | typeof DOWN | typeof LEFT | typeof RIGHT | typeof HOME | typeof END | typeof PAGE_UP | typeof PAGE_DOWN
   type SCROLL_KEY_ACTION = SCROLL_SELECT | SCROLL_MOVE_HIGHLIGHT | typeof COLLAPSE | typeof COMMIT
 
+  type FORMATTED = [string, number][]
+
+  type CANDIDATE_SPLICE = [start: number, deleteCount: number, cands: Candidate[]]
+
+  // Panel state sent by C++ on show(). Absent fields are left unchanged.
+  interface FRAME {
+    accentColor?: number | null | string
+    layout?: LAYOUT
+    writingMode?: WRITING_MODE
+    preedit?: [preCaret: FORMATTED, hasCaret: boolean, postCaret: FORMATTED]
+    aux?: [auxUp: FORMATTED, auxDown: FORMATTED]
+    candidates?: [cands: Candidate[], highlighted: number, pageable: boolean, hasPrev: boolean, hasNext: boolean, scrollState: SCROLL_STATE, scrollStart: boolean, scrollEnd: boolean]
+    candidatesPatch?: [splices: CANDIDATE_SPLICE[], highlighted: number, hasPrev: boolean, hasNext: boolean]
+    resize?: [epoch: number, dx: number, dy: number, dragging: boolean, hasContextmenu: boolean]
+  }
+
+  interface CurlResponse {
+    status: number
+    data: string
+  }
+
+  interface SseEvent {
+    event: string
+    data: string
+    id: string
+  }
+
+  type CurlStreamArgs = Record<string, unknown> & { binary?: boolean, sse?: boolean }
+  type CurlStream = AsyncGenerator<string | SseEvent, void> & { response: Promise<CurlResponse> }
+
   interface FcitxPlugin {
     load: () => void
     unload: () => void
@@ -137,8 +167,13 @@ declare global {
     (name: 'highlight', index: number): void
     (name: 'page', next: boolean): void
     (name: 'scroll', start: number, length: number): void
+    (name: 'scrollRange', session: number, start: number, length: number): void
     (name: 'askActions', index: number): void
     (name: 'action', index: number, id: number): void
+    (name: 'curlAck', stream: string, bytes: number): void
+    (name: 'curlClose', stream: string): void
+    (name: 'curlCancel', key: string): void
+    (name: 'prewarmed', ms: number, rendered: boolean): void
     (name: 'resize', epoch: number, dx: number, dy: number, anchorTop: number, anchorRight: number, anchorBottom: number, anchorLeft: number, panelTop: number, panelRight: number, panelBottom: number, panelLeft: number, topLeftRadius: number, topRightRadius: number, bottomRightRadius: number, bottomLeftRadius: number, borderWidth: number, fullWidth: number, fullHeight: number, dragging: boolean): void
 
     // JavaScript APIs that webview_candidate_window.mm calls
@@ -153,8 +188,12 @@ declare global {
     setStyle: (style: string) => void
     setWritingMode: (mode: WRITING_MODE) => void
     copyHTML: () => void
+    applyFrame: (frame: FRAME) => void
+    prewarm: (hidden: boolean) => void
     scrollKeyAction: (action: SCROLL_KEY_ACTION) => void
+    setScrollRange: (session: number, start: number, cands: Candidate[]) => void
     answerActions: (actions: CandidateAction[]) => void
+    curlChunk: (stream: string, chunk: string, bytes: number) => void
 
     // Utility functions globally available
     log: (...args: unknown[]) => void
@@ -167,6 +206,10 @@ declare global {
 
   interface Window {
     fcitx: FCITX
+    // Bound by C++ if enabled by set_api.
+    curl?: (url: string, args?: object) => Promise<CurlResponse>
+    curlCancel: (key: string) => void
+    curlStream: (url: string, args?: CurlStreamArgs) => CurlStream
   }
 }
 
@@ -1,18 +1,19 @@
 /// <reference path="./global.d.ts" />
 // @ts-expect-error parcel bundle-text prefix
 import css from 'bundle-text:./style.scss'
-import { HORIZONTAL, VERTICAL } from './constant'
+import { HORIZONTAL, HORIZONTAL_TB, SCROLL_NONE, VERTICAL, VERTICAL_LR, VERTICAL_RL } from './constant'
+import { curlCancel, curlChunk, curlStream } from './curl'
 import { setStyle } from './customize'
 import { initDistribution } from './distribution'
 import { log } from './log'
-import { hidePanel, setCandidates, updateInputPanel } from './panel'
+import { hidePanel, patchCandidates, setCandidates, updateAux, updateInputPanel, updatePreedit } from './panel'
 import { loadPlugins, pluginManager, unloadPlugins } from './plugin'
-import { initScroll, scrollKeyAction } from './scroll'
-import { hoverables, initSelectors, panel } from './selector'
+import { initScroll, scrollKeyAction, setScrollRange } from './scroll'
+import { decoration, hoverables, initSelectors, panel, theme } from './selector'
 import { initTheme, setAccentColor, setTheme } from './theme'
-import { answerActions, initUx, resize } from './ux'
+import { answerActions, initUx, invalidateStyleMetrics, resize } from './ux'
 
-function setLayout(layout: 0 | 1) {
+function setLayout(layout: LAYOUT) {
   switch (layout) {
     case HORIZONTAL:
       hoverables.classList.remove('fcitx-vertical')
@@ -25,7 +26,7 @@ function setLayout(layout: 0 | 1) {
   }
 }
 
-function setWritingMode(mode: 0 | 1 | 2) {
+function setWritingMode(mode: WRITING_MODE) {
   const classes = ['fcitx-horizontal-tb', 'fcitx-vertical-rl', 'fcitx-vertical-lr']
   for (let i = 0; i < classes.length; ++i) {
     if (mode === i) {
@@ -37,6 +38,75 @@ function setWritingMode(mode: 0 | 1 | 2) {
   }
 }
 
+// Apply what changed in a show() in one call, so that C++ evaluates only one script per frame.
+function applyFrame(frame: FRAME) {
+  if ('accentColor' in frame) {
+    setAccentColor(frame.accentColor!)
+  }
+  if (frame.layout !== undefined) {
+    setLayout(frame.layout)
+  }
+  if (frame.writingMode !== undefined) {
+    setWritingMode(frame.writingMode)
+  }
+  if (frame.preedit) {
+    updatePreedit(...frame.preedit)
+  }
+  if (frame.aux) {
+    updateAux(...frame.aux)
+  }
+  if (frame.candidates) {
+    setCandidates(...frame.candidates)
+  }
+  else if (frame.candidatesPatch) {
+    patchCandidates(...frame.candidatesPatch)
+  }
+  if (frame.resize) {
+    resize(...frame.resize)
+  }
+}
+
+// Scripts and symbols whose fonts are looked up by fallback, and a long one.
+const PREWARM_CANDIDATES: Candidate[] = [
+  { text: '候选词', label: '1', comment: '注释', actions: [] },
+  { text: '候選詞', label: '2', comment: '', actions: [] },
+  { text: 'かな漢字', label: '3', comment: 'カナ', actions: [] },
+  { text: '후보', label: '4', comment: '', actions: [] },
+  { text: '🀄😂👨‍👩‍👧🇨🇳', label: '5', comment: '', actions: [] },
+  { text: '𠀀𪚥', label: '6', comment: '', actions: [] },
+  { text: 'candidate 一二三四五六七八九十', label: '7', comment: 'comment', actions: [] },
+]
+
+// Render representative candidates in each layout and writing mode while the
+// panel is hidden, then hide them, so that the first real show() doesn't pay
+// for JIT, style resolution and font fallback. Skipped if the window is shown.
+function prewarm(hidden: boolean) {
+  if (!hidden) {
+    window.fcitx('prewarmed', 0, false)
+    return
+  }
+  const start = performance.now()
+  // Laid out but not painted, and the native window is not resized.
+  theme.style.visibility = 'hidden'
+  for (const layout of [HORIZONTAL, VERTICAL] as const) {
+    for (const writingMode of [HORIZONTAL_TB, VERTICAL_RL, VERTICAL_LR] as const) {
+      applyFrame({
+        layout,
+        writingMode,
+        preedit: [[['hou xuan', 0]], true, [['词', 0]]],
+        aux: [[['🀄 拼音', 0]], []],
+        candidates: [PREWARM_CANDIDATES, 0, true, false, true, SCROLL_NONE, false, false],
+      })
+      decoration.getBoundingClientRect()
+    }
+  }
+  hidePanel()
+  setLayout(HORIZONTAL)
+  setWritingMode(HORIZONTAL_TB)
+  theme.style.visibility = ''
+  window.fcitx('prewarmed', performance.now() - start, true)
+}
+
 function copyHTML() {
   const html = document.documentElement.outerHTML
   window.fcitx('copyHTML', html)
@@ -56,6 +126,8 @@ export function initPanel(container: HTMLElement) {
     const link = document.createElement('link')
     link.id = 'fcitx-user'
     link.rel = 'stylesheet'
+    // User CSS arrives after setStyle.
+    link.addEventListener('load', invalidateStyleMetrics)
     document.head.append(link)
   }
 
@@ -107,8 +179,12 @@ export function initPanel(container: HTMLElement) {
   window.fcitx.setStyle = setStyle
   window.fcitx.setWritingMode = setWritingMode
   window.fcitx.copyHTML = copyHTML
+  window.fcitx.applyFrame = applyFrame
+  window.fcitx.prewarm = prewarm
   window.fcitx.scrollKeyAction = scrollKeyAction
+  window.fcitx.setScrollRange = setScrollRange
   window.fcitx.answerActions = answerActions
+  window.fcitx.curlChunk = curlChunk
   window.fcitx.log = log
 
   Object.defineProperty(window.fcitx, 'pluginManager', {
@@ -123,6 +199,9 @@ export function initPanel(container: HTMLElement) {
     value: unloadPlugins,
   })
 
+  window.curlCancel = curlCancel
+  window.curlStream = curlStream
+
   setTheme(0)
   window.fcitx('onload')
 }
@@ -2,9 +2,9 @@ import emojiRegex from 'emoji-regex'
 import { SCROLL_NONE, SCROLL_READY, SCROLLING } from './constant'
 import { getLabelFormatter, setLastLabels } from './format-label'
 import { fixGhostStripe } from './ghost-stripe'
-import { fetchComplete, recalculateScroll, setScrollEnd, setScrollState } from './scroll'
+import { appendScrollCandidates, fetchComplete, resetScroll, setScrollEnd, setScrollState } from './scroll'
 import { auxDown, auxUp, hoverables, preedit, theme } from './selector'
-import { div, getHoverBehavior, getPagingButtonsStyle, hideContextmenu, resetMouseMoveState, setActions } from './ux'
+import { div, getHoverBehavior, getPagingButtonsStyle, hideContextmenu, resetMouseMoveState, setActions, spliceActions } from './ux'
 
 const regex = emojiRegex()
 const segmenter = new Intl.Segmenter(undefined, { granularity: 'grapheme' })
@@ -62,6 +62,87 @@ const caretRight = common.replace('{}', '0 0 192 512').replace('{}', 'M0 384.662
 const arrowBack = common.replace('{}', '0 0 24 24').replace('{}', 'M16.62 2.99a1.25 1.25 0 0 0-1.77 0L6.54 11.3a.996.996 0 0 0 0 1.41l8.31 8.31c.49.49 1.28.49 1.77 0s.49-1.28 0-1.77L9.38 12l7.25-7.25c.48-.48.48-1.28-.01-1.76z')
 const arrowForward = common.replace('{}', '0 0 24 24').replace('{}', 'M7.38 21.01c.49.49 1.28.49 1.77 0l8.31-8.31a.996.996 0 0 0 0-1.41L9.15 2.98c-.49-.49-1.28-.49-1.77 0s-.49 1.28 0 1.77L14.62 12l-7.25 7.25c-.48.48-.48 1.28.01 1.76z')
 
+function listenHover(hoverable: Element) {
+  hoverable.addEventListener('mousemove', () => {
+    const hoverBehavior = getHoverBehavior()
+    if (hoverBehavior === 'Move' && hoverables.classList.contains('fcitx-mousemoved')) {
+      const lastHighlighted = hoverables.querySelector('.fcitx-highlighted')
+      moveHighlight(lastHighlighted, hoverable)
+    }
+  })
+}
+
+function renderCandidate(cand: Candidate, withMark: boolean, withLabel: boolean, label0: string) {
+  const candidate = div('fcitx-candidate', 'fcitx-hoverable')
+  const candidateInner = div('fcitx-candidate-inner', 'fcitx-hoverable-inner')
+
+  // Render placeholder for vertical/scroll non-highlighted candidates
+  if (withMark) {
+    candidateInner.append(renderMark())
+  }
+
+  if (cand.label || withLabel) {
+    const label = div('fcitx-label')
+    label.textContent = cand.label || label0
+    candidateInner.append(label)
+  }
+
+  const text = div('fcitx-text')
+  text.textContent = cand.text
+  if (isSingleEmoji(cand.text)) {
+    // Hack: for vertical-lr writing mode, 🙅‍♂️ is rotated on Safari and split to 🙅 and ♂ on Chrome.
+    // Can't find a way that works for text that contains not only emoji (e.g. for preedit) but
+    // it's a rare case for candidates so should be acceptable.
+    text.style.writingMode = 'horizontal-tb'
+  }
+  candidateInner.append(text)
+
+  if (cand.comment) {
+    const comment = div('fcitx-comment')
+    comment.textContent = cand.comment
+    if (cand.spaceBetweenComment === false) {
+      comment.style.setProperty('--text-margin-left-scale', '-1')
+      comment.style.setProperty('--vertical-comment-flex', '0')
+    }
+    candidateInner.append(comment)
+  }
+
+  candidate.append(div('fcitx-candidate-background')) // The only purpose is to fix ghost stripe.
+  candidate.append(candidateInner)
+  listenHover(candidate)
+  return candidate
+}
+
+function renderMark() {
+  const mark = div('fcitx-mark')
+  if (markText === '') {
+    mark.classList.add('fcitx-no-text')
+  }
+  else {
+    mark.textContent = markText
+  }
+  return mark
+}
+
+// Unify label width for vertical and scroll mode, as some fonts have different widths for numbers.
+function unifyLabelWidth() {
+  theme.style.removeProperty('--label-width')
+  let maxWidth = 0
+  hoverables.querySelectorAll('.fcitx-label').forEach((label) => {
+    maxWidth = Math.max(maxWidth, label.getBoundingClientRect().width)
+  })
+  theme.style.setProperty('--label-width', `${maxWidth}px`)
+}
+
+// State of the last non-scroll render, which patchCandidates works on.
+let labels: string[] = []
+let highlightedIndex = -1
+
+// Candidate i is hoverables.children[2 * i], followed by its divider.
+function candidateAt(i: number) {
+  return i >= 0 && i < labels.length ? hoverables.children[2 * i] : null
+}
+
 export function setCandidates(cands: Candidate[], highlighted: number, pageable: boolean, hasPrev: boolean, hasNext: boolean, scrollState: SCROLL_STATE, scrollStart: boolean, scrollEnd: boolean) {
   if (cands.length) {
     // Auto layout requires display: not none so that getBoundingClientRect works.
@@ -75,6 +156,7 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
   if (scrollState !== SCROLLING || scrollStart) {
     hoverables.innerHTML = ''
     hoverables.scrollTop = 0 // Otherwise last scroll position will be kept.
+    resetScroll()
   }
   else {
     fetchComplete()
@@ -94,66 +176,31 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
       hoverables.style.maxBlockSize = ''
     }
   }
+  labels = cands.map(c => c.label)
+  highlightedIndex = highlighted
   const label0 = getLabelFormatter()(0)
-  for (let i = 0; i < cands.length; ++i) {
-    const candidate = div('fcitx-candidate', 'fcitx-hoverable')
-    if (i === 0 && scrollState !== SCROLLING) {
-      candidate.classList.add('fcitx-candidate-first')
-    }
-    if (i === highlighted) {
-      candidate.classList.add('fcitx-highlighted', 'fcitx-highlighted-original')
-    }
-    if (i === cands.length - 1 && scrollState !== SCROLLING) {
-      candidate.classList.add('fcitx-candidate-last')
-    }
-
-    const candidateInner = div('fcitx-candidate-inner', 'fcitx-hoverable-inner')
-
-    // Render placeholder for vertical/scroll non-highlighted candidates
-    if (isVertical || hoverables.classList.contains('fcitx-horizontal-scroll') || i === highlighted) {
-      const mark = div('fcitx-mark')
-      if (markText === '') {
-        mark.classList.add('fcitx-no-text')
+  if (scrollState === SCROLLING) {
+    // Laid out in rows by scroll.ts, which renders only those in view.
+    appendScrollCandidates(cands, scrollStart, cand => renderCandidate(cand, true, true, label0), divider)
+  }
+  else {
+    for (let i = 0; i < cands.length; ++i) {
+      const candidate = renderCandidate(cands[i], isVertical || i === highlighted, false, label0)
+      if (i === 0) {
+        candidate.classList.add('fcitx-candidate-first')
       }
-      else {
-        mark.textContent = markText
+      if (i === highlighted) {
+        candidate.classList.add('fcitx-highlighted', 'fcitx-highlighted-original')
       }
-      candidateInner.append(mark)
-    }
-
-    if (cands[i].label || scrollState === SCROLLING) {
-      const label = div('fcitx-label')
-      label.textContent = cands[i].label || label0
-      candidateInner.append(label)
-    }
-
-    const text = div('fcitx-text')
-    text.textContent = cands[i].text
-    if (isSingleEmoji(cands[i].text)) {
-      // Hack: for vertical-lr writing mode, 🙅‍♂️ is rotated on Safari and split to 🙅 and ♂ on Chrome.
-      // Can't find a way that works for text that contains not only emoji (e.g. for preedit) but
-      // it's a rare case for candidates so should be acceptable.
-      text.style.writingMode = 'horizontal-tb'
-    }
-    candidateInner.append(text)
-
-    if (cands[i].comment) {
-      const comment = div('fcitx-comment')
-      comment.textContent = cands[i].comment
-      if (cands[i].spaceBetweenComment === false) {
-        comment.style.setProperty('--text-margin-left-scale', '-1')
-        comment.style.setProperty('--vertical-comment-flex', '0')
+      if (i === cands.length - 1) {
+        candidate.classList.add('fcitx-candidate-last')
       }
-      candidateInner.append(comment)
-    }
+      hoverables.append(candidate)
 
-    candidate.append(div('fcitx-candidate-background')) // The only purpose is to fix ghost stripe.
-    candidate.append(candidateInner)
-    hoverables.append(candidate)
-
-    // For horizontal/scroll mode it needs to fill the row when candidates are not enough.
-    // For vertical mode, this last divider is hidden.
-    hoverables.append(divider())
+      // For horizontal mode it needs to fill the row when candidates are not enough.
+      // For vertical mode, this last divider is hidden.
+      hoverables.append(divider())
+    }
   }
 
   setActions(cands.map(c => c.actions))
@@ -165,6 +212,7 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
     const paging = div('fcitx-paging', 'fcitx-scroll', 'fcitx-hoverable')
     paging.append(expand)
     hoverables.append(paging)
+    listenHover(paging)
   }
   else if (scrollState === SCROLL_NONE && pageable) {
     const isArrow = getPagingButtonsStyle() === 'Arrow'
@@ -177,6 +225,7 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
     }
     prevInner.innerHTML = isArrow ? arrowBack : caretLeft
     prev.appendChild(prevInner)
+    listenHover(prev)
 
     const next = div('fcitx-next', 'fcitx-hoverable')
     const nextInner = div('fcitx-paging-inner')
@@ -185,6 +234,7 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
     }
     nextInner.innerHTML = isArrow ? arrowForward : caretRight
     next.appendChild(nextInner)
+    listenHover(next)
 
     const paging = div('fcitx-paging')
     if (isArrow) {
@@ -197,30 +247,79 @@ export function setCandidates(cands: Candidate[], highlighted: number, pageable:
     paging.appendChild(next)
     hoverables.appendChild(paging)
   }
-  else if (scrollState === SCROLLING) {
-    recalculateScroll(scrollStart)
+
+  if ((isVertical && new Set(labels.map(label => label.length)).size === 1) || scrollStart) {
+    unifyLabelWidth()
+  }
+  else if (scrollState !== SCROLLING) {
+    theme.style.removeProperty('--label-width')
   }
 
-  for (const hoverable of hoverables.querySelectorAll('.fcitx-hoverable')) {
-    hoverable.addEventListener('mousemove', () => {
-      const hoverBehavior = getHoverBehavior()
-      if (hoverBehavior === 'Move' && hoverables.classList.contains('fcitx-mousemoved')) {
-        const lastHighlighted = hoverables.querySelector('.fcitx-highlighted')
-        moveHighlight(lastHighlighted, hoverable)
-      }
-    })
+  fixGhostStripe()
+}
+
+// Update candidates rendered by the last setCandidates in SCROLL_NONE state without rebuilding them.
+// Each splice [start, deleteCount, cands] is applied in order like Array.prototype.splice,
+// so a highlight-only update touches no more than the 2 candidates involved.
+export function patchCandidates(splices: CANDIDATE_SPLICE[], highlighted: number, hasPrev: boolean, hasNext: boolean) {
+  theme.classList.remove('fcitx-hidden')
+  const isVertical = hoverables.classList.contains('fcitx-vertical')
+  resetMouseMoveState()
+  hideContextmenu()
+
+  // Hover may have moved highlight away from the original one.
+  hoverables.querySelector('.fcitx-highlighted')?.classList.remove('fcitx-highlighted')
+  candidateAt(highlightedIndex)?.classList.remove('fcitx-highlighted', 'fcitx-highlighted-original')
+
+  for (const [start, deleteCount, cands] of splices) {
+    for (let i = 0; i < deleteCount; ++i) {
+      hoverables.children[2 * start + 1].remove()
+      hoverables.children[2 * start].remove()
+    }
+    const next = hoverables.children[2 * start] ?? null
+    for (const cand of cands) {
+      hoverables.insertBefore(renderCandidate(cand, isVertical, false, ''), next)
+      hoverables.insertBefore(divider(), next)
+    }
+    labels.splice(start, deleteCount, ...cands.map(c => c.label))
+    spliceActions(start, deleteCount, cands.map(c => c.actions))
   }
 
-  // Unify label width for vertical and scroll mode, as some fonts have different widths for numbers.
-  if ((isVertical && new Set(cands.map(cand => cand.label.length)).size === 1) || scrollStart) {
-    theme.style.removeProperty('--label-width')
-    let maxWidth = 0
-    hoverables.querySelectorAll('.fcitx-label').forEach((label) => {
-      maxWidth = Math.max(maxWidth, label.getBoundingClientRect().width)
-    })
-    theme.style.setProperty('--label-width', `${maxWidth}px`)
+  highlightedIndex = highlighted
+  const candidate = candidateAt(highlighted)
+  candidate?.classList.add('fcitx-highlighted', 'fcitx-highlighted-original')
+  if (!isVertical) {
+    // Horizontal mode has a unique mark that lives in the highlighted candidate.
+    const mark = hoverables.querySelector('.fcitx-mark')
+    const inner = candidate?.querySelector('.fcitx-candidate-inner')
+    if (!inner) {
+      mark?.remove()
+    }
+    else if (!mark) {
+      inner.prepend(renderMark())
+    }
+    else if (mark.parentElement !== inner) {
+      inner.prepend(mark)
+    }
   }
-  else if (scrollState !== SCROLLING) {
+
+  const prevInner = hoverables.querySelector('.fcitx-prev .fcitx-paging-inner')
+  prevInner?.classList.toggle('fcitx-hoverable-inner', hasPrev)
+  const nextInner = hoverables.querySelector('.fcitx-next .fcitx-paging-inner')
+  nextInner?.classList.toggle('fcitx-hoverable-inner', hasNext)
+
+  if (splices.length === 0) {
+    return
+  }
+  hoverables.querySelector('.fcitx-candidate-first')?.classList.remove('fcitx-candidate-first')
+  hoverables.querySelector('.fcitx-candidate-last')?.classList.remove('fcitx-candidate-last')
+  candidateAt(0)?.classList.add('fcitx-candidate-first')
+  candidateAt(labels.length - 1)?.classList.add('fcitx-candidate-last')
+
+  if (isVertical && new Set(labels.map(label => label.length)).size === 1) {
+    unifyLabelWidth()
+  }
+  else {
     theme.style.removeProperty('--label-width')
   }
 
@@ -242,9 +341,9 @@ function updateElement(element: Element, formatted: [string, number][]) {
   }
 }
 
-export function updateInputPanel(formattedPreCaret: [string, number][], hasCaret: boolean, formattedPostCaret: [string, number][], formattedAuxUp: [string, number][], formattedAuxDown: [string, number][]) {
+export function updatePreedit(formattedPreCaret: [string, number][], hasCaret: boolean, formattedPostCaret: [string, number][]) {
   const hasPreedit = formattedPreCaret.length || formattedPostCaret.length
-  if (hasPreedit || formattedAuxUp.length || formattedAuxDown.length) {
+  if (hasPreedit) {
     theme.classList.remove('fcitx-hidden')
   }
   hideContextmenu()
@@ -270,10 +369,22 @@ export function updateInputPanel(formattedPreCaret: [string, number][], hasCaret
   else {
     preedit.classList.add('fcitx-hidden')
   }
+}
+
+export function updateAux(formattedAuxUp: [string, number][], formattedAuxDown: [string, number][]) {
+  if (formattedAuxUp.length || formattedAuxDown.length) {
+    theme.classList.remove('fcitx-hidden')
+  }
+  hideContextmenu()
   updateElement(auxUp, formattedAuxUp)
   updateElement(auxDown, formattedAuxDown)
 }
 
+export function updateInputPanel(formattedPreCaret: [string, number][], hasCaret: boolean, formattedPostCaret: [string, number][], formattedAuxUp: [string, number][], formattedAuxDown: [string, number][]) {
+  updatePreedit(formattedPreCaret, hasCaret, formattedPostCaret)
+  updateAux(formattedAuxUp, formattedAuxDown)
+}
+
 export function hidePanel() {
   updateInputPanel([], false, [], [], [])
   setCandidates([], -1, false, false, false, SCROLL_NONE, false, false)
@@ -4,8 +4,8 @@ import {
   hoverables,
 } from './selector'
 import {
+  div,
   hideContextmenu,
-  resizeForAnimation,
 } from './ux'
 
 let MAX_ROW = 6
@@ -66,124 +66,311 @@ function collapse() {
   }
 }
 
-let rowItemCount: number[] = []
+// In SCROLLING state, geometry of all candidates fetched is kept as numbers, and only rows
+// [firstRow, endRow) around the viewport are in DOM, so that the cost of scrolling and
+// fetching doesn't grow with the number of candidates.
+let cellCounts: number[] = [] // Cells taken by each candidate.
+let lastRowCells = 0
+let rowStarts: number[] = [] // Index of the first candidate of each row.
+let rowHeights: number[] = []
+let rowTops: number[] = [0] // Offset of each row in hoverables, followed by the bottom.
+let firstRow = 0
+let endRow = 0
+let rendered: HTMLElement[] = [] // Candidates of rendered rows.
+let bottomSpacer: HTMLElement | null = null
+// Data of rendered candidates. The rest is fetched from C++ when scrolled back to.
+const loaded = new Map<number, Candidate>()
+// Tells responses of scrollRange for previous candidates apart.
+let session = 0
+let renderCandidate: (cand: Candidate) => HTMLElement
+let renderDivider: () => HTMLElement
 let highlighted = 0
 
-function itemCountInFirstNRows(n: number): number {
-  return rowItemCount.slice(0, n).reduce((sum, count) => sum + count, 0)
+export function resetScroll() {
+  cellCounts = []
+  lastRowCells = 0
+  rowStarts = []
+  rowHeights = []
+  rowTops = [0]
+  firstRow = 0
+  endRow = 0
+  rendered = []
+  bottomSpacer = null
+  loaded.clear()
+  ++session
 }
 
-function getRowOf(index: number): number {
-  let skipped = 0
-  for (let i = 0; i < rowItemCount.length - 1; ++i) {
-    const end = skipped + rowItemCount[i]
-    if (index < end) {
-      return i
+function rowStart(row: number) {
+  return row < rowStarts.length ? rowStarts[row] : cellCounts.length
+}
+
+// Index of the last element of sorted array that is not greater than value, or 0.
+function lastNotAbove(array: number[], value: number, length: number) {
+  let lo = 0
+  let hi = length
+  while (hi - lo > 1) {
+    const mid = (lo + hi) >> 1
+    if (array[mid] <= value) {
+      lo = mid
+    }
+    else {
+      hi = mid
     }
-    skipped = end
   }
-  return rowItemCount.length - 1
+  return lo
+}
+
+function getRowOf(index: number): number {
+  return lastNotAbove(rowStarts, index, rowStarts.length)
+}
+
+function getRowAt(offset: number): number {
+  return lastNotAbove(rowTops, offset, rowStarts.length)
 }
 
 function getHighlightedRow(): number {
   return getRowOf(highlighted)
 }
 
-function distanceToTop(element: Element, basis: 'top' | 'bottom') {
-  return element.getBoundingClientRect()[basis] - hoverables.getBoundingClientRect().top
+// Offset of the first rendered candidate among all, for mapping DOM to index.
+export function getRenderedStart() {
+  return scrollState === SCROLLING ? rowStart(firstRow) : 0
 }
 
-function scrollForHighlight() {
-  const candidates = hoverables.querySelectorAll('.fcitx-candidate')
+function renderedAt(index: number): HTMLElement | undefined {
+  const offset = index - rowStart(firstRow)
+  return offset >= 0 ? rendered[offset] : undefined
+}
 
-  const bottomOffset = distanceToTop(candidates[highlighted], 'bottom') - hoverables.clientHeight
+function scrollForHighlight() {
+  const row = getHighlightedRow()
+  const bottomOffset = rowTops[row + 1] - hoverables.scrollTop - hoverables.clientHeight
   // Highlighted candidate below bottom of panel
   if (bottomOffset > 0) {
     hoverables.scrollTop += bottomOffset
   }
 
-  const topOffset = distanceToTop(candidates[highlighted], 'top')
+  const topOffset = rowTops[row] - hoverables.scrollTop
   // Highlighted candidate above top of panel
   if (topOffset < 0) {
     hoverables.scrollTop += topOffset
   }
+  renderRows(false)
 }
 
 function renderLabel(candidate: Element, i: number) {
   const formatter = getLabelFormatter()
-  const label = candidate.querySelector('.fcitx-label')!
-  label.textContent = formatter(i)
+  const label = candidate.querySelector('.fcitx-label')
+  if (label) { // Not a placeholder.
+    label.textContent = formatter(i)
+  }
+}
+
+function paintHighlight(on: boolean) {
+  if (!rowStarts.length) {
+    return
+  }
+  const highlightedRow = getHighlightedRow()
+  const skipped = rowStart(highlightedRow)
+  for (let i = skipped; i < rowStart(highlightedRow + 1); ++i) {
+    const candidate = renderedAt(i)
+    if (candidate) {
+      candidate.classList.toggle('fcitx-highlighted-row', on)
+      renderLabel(candidate, on ? (i - skipped + 1) % 10 : 0)
+    }
+  }
+  const candidate = renderedAt(highlighted)
+  if (on) {
+    candidate?.classList.add('fcitx-highlighted', 'fcitx-highlighted-original')
+  }
+  else {
+    candidate?.classList.remove('fcitx-highlighted', 'fcitx-highlighted-original')
+  }
 }
 
 function renderHighlightAndLabels(newHighlighted: number, clearOld: boolean) {
   window.fcitx('highlight', newHighlighted) // Call it on both expand and highlight move.
-  const candidates = hoverables.querySelectorAll('.fcitx-candidate')
   if (clearOld) {
-    const highlightedRow = getHighlightedRow()
-    const skipped = itemCountInFirstNRows(highlightedRow)
-    for (let i = skipped; i < skipped + rowItemCount[highlightedRow]; ++i) {
-      const candidate = candidates[i]
-      candidate.classList.remove('fcitx-highlighted-row')
-      renderLabel(candidate, 0)
-    }
-    candidates[highlighted].classList.remove('fcitx-highlighted', 'fcitx-highlighted-original')
+    paintHighlight(false)
   }
-
   highlighted = newHighlighted
+  paintHighlight(true)
+}
 
-  const highlightedRow = getHighlightedRow()
-  const skipped = itemCountInFirstNRows(highlightedRow)
-  for (let i = skipped; i < skipped + rowItemCount[highlightedRow]; ++i) {
-    const candidate = candidates[i]
-    candidate.classList.add('fcitx-highlighted-row')
-    renderLabel(candidate, (i - skipped + 1) % 10)
+function spacer(height: number) {
+  const element = div('fcitx-scroll-spacer')
+  element.style.blockSize = `${height}px`
+  return element
+}
+
+function updateRowTops(from: number) {
+  rowTops.length = from + 1
+  for (let row = from; row < rowStarts.length; ++row) {
+    rowTops.push(rowTops[row] + rowHeights[row])
   }
-  candidates[highlighted].classList.add('fcitx-highlighted', 'fcitx-highlighted-original')
 }
 
-export function recalculateScroll(scrollStart: boolean) {
-  const candidates = hoverables.querySelectorAll('.fcitx-candidate')
-  rowItemCount = []
-  let itemCount = 0
-  let unitCount = 0
-  for (const candidate of candidates) {
-    candidate.classList.remove('fcitx-highlighted-row')
-    const { width } = candidate.getBoundingClientRect()
-    const nUnits = Math.min(Math.ceil(width / UNIT_WIDTH), MAX_COLUMN)
-    candidate.setAttribute('style', `width: ${nUnits * UNIT_WIDTH}px`)
-    unitCount += nUnits
-    if (unitCount <= MAX_COLUMN) {
-      ++itemCount
+// Append candidates fetched by scroll. They are measured at the end of hoverables, and stay
+// there if the last row is rendered.
+export function appendScrollCandidates(cands: Candidate[], scrollStart: boolean, render: (cand: Candidate) => HTMLElement, divider: () => HTMLElement) {
+  renderCandidate = render
+  renderDivider = divider
+  const from = cellCounts.length
+  const rowsBefore = rowStarts.length
+  const inPlace = endRow === rowsBefore
+  const elements = cands.map(render)
+  for (const element of elements) {
+    hoverables.append(element, divider())
+  }
+  if (from === 0 && elements.length) {
+    rowTops[0] = elements[0].getBoundingClientRect().top - hoverables.getBoundingClientRect().top + hoverables.scrollTop
+  }
+  for (const element of elements) {
+    const { width } = element.getBoundingClientRect()
+    cellCounts.push(Math.min(Math.ceil(width / UNIT_WIDTH), MAX_COLUMN))
+  }
+  for (let i = from; i < cellCounts.length; ++i) {
+    loaded.set(i, cands[i - from])
+    if (!rowStarts.length || lastRowCells + cellCounts[i] > MAX_COLUMN) {
+      rowStarts.push(i)
+      rowHeights.push(0)
+      lastRowCells = 0
+      const previous = elements[i - from].previousElementSibling
+      if (i > 0 && previous?.classList.contains('fcitx-divider')) {
+        (previous as HTMLElement).style.flexGrow = '1'
+      }
     }
-    else {
-      rowItemCount.push(itemCount)
-      candidate.previousElementSibling?.setAttribute('style', 'flex-grow: 1')
-      itemCount = 1
-      unitCount = nUnits
+    lastRowCells += cellCounts[i]
+    elements[i - from].style.width = `${cellCounts[i] * UNIT_WIDTH}px`
+  }
+  // Candidates of a row are stretched to its height.
+  for (let i = from; i < cellCounts.length; ++i) {
+    const row = getRowOf(i)
+    rowHeights[row] = Math.max(rowHeights[row], elements[i - from].getBoundingClientRect().height)
+  }
+  updateRowTops(Math.max(rowsBefore - 1, 0))
+
+  if (inPlace) {
+    rendered.push(...elements)
+    endRow = rowStarts.length
+  }
+  else {
+    for (const element of elements) {
+      element.nextElementSibling!.remove()
+      element.remove()
     }
+    bottomSpacer!.style.blockSize = `${rowTops[rowStarts.length] - rowTops[endRow]}px`
   }
-  rowItemCount.push(itemCount)
   renderHighlightAndLabels(scrollStart ? 0 : highlighted, !scrollStart)
+  renderRows(false)
+}
+
+// Keep the rows in the viewport plus MAX_ROW on each side in DOM, rebuilt only when the
+// viewport reaches the edge, or leaves more than twice of that behind.
+function renderRows(force: boolean) {
+  const rows = rowStarts.length
+  if (scrollState !== SCROLLING || !rows) {
+    return
+  }
+  const top = hoverables.scrollTop
+  const first = getRowAt(top)
+  const last = getRowAt(top + hoverables.clientHeight)
+  if (!force && first >= firstRow && last < endRow
+    && first - firstRow <= 2 * MAX_ROW && endRow - last <= 2 * MAX_ROW + 1) {
+    return
+  }
+  firstRow = Math.max(0, first - MAX_ROW)
+  endRow = Math.min(rows, last + 1 + MAX_ROW)
+  const start = rowStart(firstRow)
+  const end = rowStart(endRow)
+  for (const index of loaded.keys()) {
+    if (index < start || index >= end) {
+      loaded.delete(index)
+    }
+  }
+
+  const children: HTMLElement[] = []
+  if (firstRow > 0) {
+    children.push(spacer(rowTops[firstRow] - rowTops[0]))
+  }
+  rendered = []
+  let missingStart = end
+  let missingEnd = start
+  for (let row = firstRow; row < endRow; ++row) {
+    for (let i = rowStart(row); i < rowStart(row + 1); ++i) {
+      const cand = loaded.get(i)
+      const candidate = cand ? renderCandidate(cand) : div('fcitx-candidate')
+      if (!cand) {
+        // Keep the row as tall as measured, otherwise rows of placeholders collapse.
+        candidate.style.blockSize = `${rowHeights[row]}px`
+        missingStart = Math.min(missingStart, i)
+        missingEnd = i + 1
+      }
+      candidate.style.width = `${cellCounts[i] * UNIT_WIDTH}px`
+      const divider = renderDivider()
+      // The last row is filled by CSS.
+      if (i + 1 === rowStart(row + 1) && row + 1 < rows) {
+        divider.style.flexGrow = '1'
+      }
+      rendered.push(candidate)
+      children.push(candidate, divider)
+    }
+  }
+  bottomSpacer = endRow < rows ? spacer(rowTops[rows] - rowTops[endRow]) : null
+  if (bottomSpacer) {
+    children.push(bottomSpacer)
+  }
+  hoverables.replaceChildren(...children)
+  hoverables.scrollTop = top
+  paintHighlight(true)
+  if (missingStart < missingEnd) {
+    window.fcitx('scrollRange', session, missingStart, missingEnd - missingStart)
+  }
+}
+
+// Fill placeholders with candidates C++ has sent for scrollRange.
+export function setScrollRange(rangeSession: number, start: number, cands: Candidate[]) {
+  if (rangeSession !== session || scrollState !== SCROLLING) {
+    return
+  }
+  for (let i = 0; i < cands.length; ++i) {
+    const index = start + i
+    const placeholder = renderedAt(index)
+    if (!placeholder || loaded.has(index)) {
+      continue
+    }
+    loaded.set(index, cands[i])
+    const candidate = renderCandidate(cands[i])
+    candidate.style.width = placeholder.style.width
+    placeholder.replaceWith(candidate)
+    rendered[index - rowStart(firstRow)] = candidate
+  }
+  paintHighlight(true)
 }
 
 function getNeighborCandidate(index: number, direction: SCROLL_MOVE_HIGHLIGHT): number {
   const row = getRowOf(index)
-  const candidates = hoverables.querySelectorAll('.fcitx-candidate')
-  const { left, right } = candidates[index].getBoundingClientRect()
-  const mid = (left + right) / 2
+  // Horizontal positions in cells from start of row, which are the same for all rows.
+  let left = 0
+  for (let i = rowStart(row); i < index; ++i) {
+    left += cellCounts[i]
+  }
+  const mid = left + cellCounts[index] / 2
 
   function helper(row: number) {
-    if (row < 0 || row === rowItemCount.length) {
+    if (row < 0 || row === rowStarts.length) {
       return -1
     }
-    const skipped = itemCountInFirstNRows(row)
-    const last = skipped + rowItemCount[row] - 1
+    const skipped = rowStart(row)
+    const last = rowStart(row + 1) - 1
+    let right = 0
     for (let i = skipped; i < last; ++i) {
-      const rect = candidates[i].getBoundingClientRect()
-      if (rect.right <= left) {
+      const rectLeft = right
+      right += cellCounts[i]
+      if (right <= left) {
         continue
       }
-      return rect.right > mid || rect.right - left > left - rect.left ? i : i + 1
+      return right > mid || right - left > left - rectLeft ? i : i + 1
     }
     return last
   }
@@ -198,14 +385,13 @@ function getNeighborCandidate(index: number, direction: SCROLL_MOVE_HIGHLIGHT):
     case LEFT:
       return index - 1
     case RIGHT:
-      if (index + 1 < itemCountInFirstNRows(rowItemCount.length + 1)) {
+      if (index + 1 < cellCounts.length) {
         return index + 1
       }
       return -1
     case HOME:
     case END: {
-      const skipped = itemCountInFirstNRows(row)
-      return direction === HOME ? skipped : skipped + rowItemCount[row] - 1
+      return direction === HOME ? rowStart(row) : rowStart(row + 1) - 1
     }
     case PAGE_UP:
     case PAGE_DOWN: {
@@ -230,11 +416,11 @@ export function scrollKeyAction(action: SCROLL_KEY_ACTION) {
   if (action >= 0 && action <= 9) {
     const offset = (action + 9) % 10
     const highlightedRow = getHighlightedRow()
-    const n = rowItemCount[highlightedRow]
+    const n = rowStart(highlightedRow + 1) - rowStart(highlightedRow)
     if (offset >= n) {
       return
     }
-    return window.fcitx('select', itemCountInFirstNRows(highlightedRow) + offset)
+    return window.fcitx('select', rowStart(highlightedRow) + offset)
   }
   switch (action) {
     case UP:
@@ -251,9 +437,9 @@ export function scrollKeyAction(action: SCROLL_KEY_ACTION) {
         scrollForHighlight()
         if (!scrollEnd && !fetching) {
           const newHighlightedRow = getHighlightedRow()
-          if (rowItemCount.length - newHighlightedRow <= MAX_ROW) {
+          if (rowStarts.length - newHighlightedRow <= MAX_ROW) {
             fetching = true
-            window.fcitx('scroll', itemCountInFirstNRows(rowItemCount.length), MAX_ROW * MAX_COLUMN)
+            window.fcitx('scroll', cellCounts.length, MAX_ROW * MAX_COLUMN)
           }
         }
       }
@@ -280,27 +466,29 @@ export function initScroll() {
   })
 
   hoverables.addEventListener('scroll', () => {
+    if (scrollState !== SCROLLING) {
+      return
+    }
+    renderRows(false)
     if (scrollEnd || fetching) {
       return
     }
-    // This is safe since there are at least 2 lines.
-    const bottomRightIndex = itemCountInFirstNRows(rowItemCount.length - 1) - 1
-    const candidates = hoverables.querySelectorAll('.fcitx-candidate')
-    const bottomRight = candidates[bottomRightIndex]
-    if (distanceToTop(bottomRight, 'top') < hoverables.clientHeight) {
+    // Fetch when the second last row comes into view.
+    const row = Math.max(rowStarts.length - 2, 0)
+    if (rowTops[row] - hoverables.scrollTop < hoverables.clientHeight) {
       fetching = true
-      window.fcitx('scroll', candidates.length, MAX_ROW * MAX_COLUMN)
+      window.fcitx('scroll', cellCounts.length, MAX_ROW * MAX_COLUMN)
     }
   })
 
-  // Expand/collapse animation. Sync with native window for position, size and blur.
+  // Expand/collapse animation. The native window follows by ResizeObserver of ux.ts.
   const resizeObserver = new ResizeObserver((entries) => {
     if (scrollState === SCROLL_READY) {
       collapseHeight = Math.max(ROW_HEIGHT, entries[0].contentRect.height /* may be 0 so trust it only if a candidate has multiple lines */)
       // Set max-block-size as the actual value to enable expand animation.
       hoverables.style.maxBlockSize = `${collapseHeight}px`
     }
-    resizeForAnimation()
+    renderRows(false) // More rows may be in view.
   })
   resizeObserver.observe(hoverables)
 }
@@ -0,0 +1,62 @@
+// Incremental parser of text/event-stream, fed with chunks split anywhere.
+// https://html.spec.whatwg.org/multipage/server-sent-events.html#event-stream-interpretation
+export class SseParser {
+  private buffer = ''
+  private data: string[] = []
+  private event = ''
+  private id = ''
+
+  feed(chunk: string): SseEvent[] {
+    const events: SseEvent[] = []
+    this.buffer += chunk
+    let start = 0
+    while (true) {
+      const end = this.buffer.slice(start).search(/[\r\n]/)
+      if (end < 0) {
+        break
+      }
+      const lineEnd = start + end
+      // A trailing \r may be the first half of \r\n.
+      if (this.buffer[lineEnd] === '\r' && lineEnd + 1 === this.buffer.length) {
+        break
+      }
+      this.line(this.buffer.slice(start, lineEnd), events)
+      start = lineEnd + (this.buffer.startsWith('\r\n', lineEnd) ? 2 : 1)
+    }
+    this.buffer = this.buffer.slice(start)
+    return events
+  }
+
+  private line(line: string, events: SseEvent[]) {
+    if (line === '') {
+      if (this.data.length) {
+        events.push({ event: this.event || 'message', data: this.data.join('\n'), id: this.id })
+      }
+      this.data = []
+      this.event = ''
+      return
+    }
+    if (line.startsWith(':')) {
+      return // Comment.
+    }
+    const colon = line.indexOf(':')
+    const field = colon < 0 ? line : line.slice(0, colon)
+    let value = colon < 0 ? '' : line.slice(colon + 1)
+    if (value.startsWith(' ')) {
+      value = value.slice(1)
+    }
+    switch (field) {
+      case 'data':
+        this.data.push(value)
+        break
+      case 'event':
+        this.event = value
+        break
+      case 'id':
+        if (!value.includes('\0')) {
+          this.id = value
+        }
+        break
+    }
+  }
+}
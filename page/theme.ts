@@ -1,6 +1,7 @@
 import {
   theme,
 } from './selector'
+import { invalidateStyleMetrics } from './ux'
 
 let darkMQL: MediaQueryList | undefined
 let isSystemDark = false
@@ -49,6 +50,7 @@ export function initTheme() {
 }
 
 export function setTheme(theme: 0 | 1 | 2) {
+  invalidateStyleMetrics()
   switch (theme) {
     case 0:
       followSystemTheme = true
@@ -1,6 +1,7 @@
 import { moveHighlight } from './panel'
 import {
   expand,
+  getRenderedStart,
   getScrollState,
 } from './scroll'
 import {
@@ -34,6 +35,9 @@ let actions: CandidateAction[][] = []
 export function setActions(newActions: CandidateAction[][]) {
   actions = newActions
 }
+export function spliceActions(start: number, deleteCount: number, newActions: CandidateAction[][]) {
+  actions.splice(start, deleteCount, ...newActions)
+}
 
 let actionX = 0
 let actionY = 0
@@ -66,14 +70,6 @@ export function setBlink(enabled: boolean) {
 
 let blinkSwitch = false
 
-interface ShadowBox {
-  anchorTop: number
-  anchorRight: number
-  anchorLeft: number
-  right: number
-  bottom: number
-}
-
 // Follow CSS border-radius rules to expand to 4 values.
 function expandRadiusTo4(radius: number[]): number[] {
   switch (radius.length) {
@@ -90,6 +86,56 @@ function expandRadiusTo4(radius: number[]): number[] {
   }
 }
 
+// Values resize() derives from computed style, which are parsed again only when what they depend
+// on may have changed: a new style or theme, or classes that select different radii.
+interface StyleMetrics {
+  radius4: number[]
+  borderWidth: number
+  // How far shadows extend beyond right and bottom.
+  shadowRight: number
+  shadowBottom: number
+}
+
+let styleGeneration = 0
+let panelMetrics: StyleMetrics = { radius4: [0, 0, 0, 0], borderWidth: 0, shadowRight: 0, shadowBottom: 0 }
+let panelMetricsKey = ''
+let contextmenuMetrics = panelMetrics
+let contextmenuMetricsKey = ''
+
+export function invalidateStyleMetrics() {
+  ++styleGeneration
+}
+
+export function getStyleGeneration() {
+  return styleGeneration
+}
+
+function readStyleMetrics(element: Element): StyleMetrics {
+  const { borderRadius, borderWidth, boxShadow } = getComputedStyle(element)
+  let shadowRight = 0
+  let shadowBottom = 0
+  // The format of computed style is 'rgba(255, 0, 0, 0.5) 10px 5px 5px 0px, rgb(255, 0, 0) 10px 5px 5px 0px' or 'none'.
+  // Drop colors so that each shadow is only its lengths, which must not be NaN for resize() to compare geometry.
+  for (const shadow of boxShadow.replace(/[\w-]+\([^)]*\)/g, '').split(',')) {
+    const [offsetX, offsetY, blurRadius = 0, spreadRadius = 0] = shadow.split(' ').map(Number.parseFloat).filter(value => !Number.isNaN(value))
+    if (offsetY === undefined) {
+      continue
+    }
+    shadowRight = Math.max(shadowRight, offsetX + blurRadius + spreadRadius)
+    shadowBottom = Math.max(shadowBottom, offsetY + blurRadius + spreadRadius)
+  }
+  return {
+    radius4: expandRadiusTo4(borderRadius.split(' ').map(Number.parseFloat)),
+    borderWidth: Math.max(...borderWidth.split(' ').map(Number.parseFloat)),
+    shadowRight,
+    shadowBottom,
+  }
+}
+
+// Geometry last sent to C++, so that a ResizeObserver callback with nothing changed costs no call.
+let sentEpoch = -1
+let sentGeometry: number[] = []
+
 export function resize(
   new_epoch: number,
   dx: number,
@@ -98,88 +144,61 @@ export function resize(
   hasContextmenu: boolean,
 ) {
   epoch = new_epoch
-  function adaptWindowSize(reserveSpaceForContextmenu: boolean) {
-    let {
-      anchorTop,
-      anchorRight,
-      anchorLeft,
-      right,
-      bottom,
-    } = getBoundingRectWithShadow(panel)
-
-    // Account for window decorations.
-    const dRect = decoration.getBoundingClientRect()
-    anchorTop = Math.min(anchorTop, dRect.top)
-    anchorLeft = Math.min(anchorLeft, dRect.left)
-    if (dRect.right > right) {
-      anchorRight = right = dRect.right
-    }
-    // Always use decoration's bottom as anchorBottom because
-    // 1. When no decoration, it's the same with panel's.
-    // 2. When there is decoration and no enough room under client preedit,
-    //    we don't want layout shift of decoration when scroll is expanded.
-    const anchorBottom = dRect.bottom
-    if (anchorBottom > bottom) {
-      bottom = dRect.bottom
-    }
-
-    // HACK: enlarge then shrink.
-    if (reserveSpaceForContextmenu) {
-      right += 100
-      bottom += 100
-    }
-    else if (contextmenu.style.display === 'block') {
-      const {
-        right: r,
-        bottom: b,
-      } = getBoundingRectWithShadow(contextmenu)
-      right = Math.max(right, r)
-      bottom = Math.max(bottom, b)
-    }
-
-    const pRect = panel.getBoundingClientRect()
-    const { borderRadius, borderWidth } = getComputedStyle(panel)
-    const bWidth = Math.max(...borderWidth.split(' ').map(Number.parseFloat))
-    const parsedRadius = borderRadius.split(' ').map(Number.parseFloat)
-    const radius4 = expandRadiusTo4(parsedRadius)
-    window.fcitx('resize', epoch, dx, dy, anchorTop, anchorRight, anchorBottom, anchorLeft, pRect.top, pRect.right, pRect.bottom, pRect.left, radius4[0], radius4[1], radius4[2], radius4[3], bWidth, right, bottom, dragging)
+  const withContextmenu = !hasContextmenu && contextmenu.style.display === 'block'
+  // Reading classes and cached style doesn't need layout.
+  const key = `${styleGeneration} ${theme.className} ${panel.className} ${hoverables.classList.contains('fcitx-vertical')} ${hoverables.classList.contains('fcitx-horizontal-scroll')} ${hoverables.lastElementChild?.className}`
+  if (key !== panelMetricsKey) {
+    panelMetrics = readStyleMetrics(panel)
+    panelMetricsKey = key
+  }
+  const menuKey = `${styleGeneration} ${theme.className}`
+  if (withContextmenu && menuKey !== contextmenuMetricsKey) {
+    contextmenuMetrics = readStyleMetrics(contextmenu)
+    contextmenuMetricsKey = menuKey
+  }
+  // All geometry in one layout.
+  const pRect = panel.getBoundingClientRect()
+  const dRect = decoration.getBoundingClientRect()
+  const cRect = withContextmenu ? contextmenu.getBoundingClientRect() : null
+
+  // Extend the panel to contain the shadow, and account for window decorations.
+  const anchorTop = Math.min(pRect.top, dRect.top)
+  const anchorLeft = Math.min(pRect.left, dRect.left)
+  let anchorRight = pRect.right
+  let right = pRect.right + panelMetrics.shadowRight
+  let bottom = pRect.bottom + panelMetrics.shadowBottom
+  if (dRect.right > right) {
+    anchorRight = right = dRect.right
+  }
+  // Always use decoration's bottom as anchorBottom because
+  // 1. When no decoration, it's the same with panel's.
+  // 2. When there is decoration and no enough room under client preedit,
+  //    we don't want layout shift of decoration when scroll is expanded.
+  const anchorBottom = dRect.bottom
+  if (anchorBottom > bottom) {
+    bottom = dRect.bottom
   }
-  adaptWindowSize(hasContextmenu)
-  // With ResizeObserver, we probably don't need to call adaptWindowSize again by requestAnimationFrame.
-}
 
-export const resizeForAnimation = () => resize(epoch, 0, 0, false, false)
-
-function getBoundingRectWithShadow(element: Element): ShadowBox {
-  const rect = element.getBoundingClientRect()
-  let xHi = rect.right
-  let yHi = rect.bottom
-
-  const vals = window.getComputedStyle(element).boxShadow.split(' ').map(Number.parseFloat)
-  // The format of computed style is 'rgb(255, 0, 0) 10px 5px 5px 0px, rgb(255, 0, 0) 10px 5px 5px 0px'
-  // Therefore, vals has exactly (7*n) elements, and vals[7*i] will be NaN.
-  for (let i = 0; i < vals.length / 7; i += 1) {
-    const offsetX = vals[7 * i + 3]
-    const offsetY = vals[7 * i + 4]
-    const blurRadius = vals[7 * i + 5]
-    const spreadRadius = vals[7 * i + 6]
-    const deltaX = offsetX + blurRadius + spreadRadius
-    const deltaY = offsetY + blurRadius + spreadRadius
-    const shadowXHi = rect.right + (deltaX > 0 ? deltaX : 0)
-    const shadowYHi = rect.bottom + (deltaY > 0 ? deltaY : 0)
-    if (shadowXHi > xHi)
-      xHi = shadowXHi
-    if (shadowYHi > yHi)
-      yHi = shadowYHi
+  // HACK: enlarge then shrink.
+  if (hasContextmenu) {
+    right += 100
+    bottom += 100
   }
-  // Extend the rect to contain the shadow.
-  return {
-    anchorTop: rect.top,
-    anchorRight: rect.right,
-    anchorLeft: rect.left,
-    right: xHi,
-    bottom: yHi,
+  else if (cRect) {
+    right = Math.max(right, cRect.right + contextmenuMetrics.shadowRight)
+    bottom = Math.max(bottom, cRect.bottom + contextmenuMetrics.shadowBottom)
+  }
+
+  const [topLeftRadius, topRightRadius, bottomRightRadius, bottomLeftRadius] = panelMetrics.radius4
+  const { borderWidth } = panelMetrics
+  const geometry = [anchorTop, anchorRight, anchorBottom, anchorLeft, pRect.top, pRect.right, pRect.bottom, pRect.left, topLeftRadius, topRightRadius, bottomRightRadius, bottomLeftRadius, borderWidth, right, bottom]
+  // C++ places the window on each new epoch, but needs nothing for the same geometry again.
+  if (epoch === sentEpoch && !dx && !dy && !dragging && geometry.every((value, i) => value === sentGeometry[i])) {
+    return
   }
+  sentEpoch = epoch
+  sentGeometry = geometry
+  window.fcitx('resize', epoch, dx, dy, anchorTop, anchorRight, anchorBottom, anchorLeft, pRect.top, pRect.right, pRect.bottom, pRect.left, topLeftRadius, topRightRadius, bottomRightRadius, bottomLeftRadius, borderWidth, right, bottom, dragging)
 }
 
 export function div(...classList: string[]) {
@@ -196,7 +215,7 @@ function getCandidateIndex(target: Element) {
   const allCandidates = hoverables.querySelectorAll('.fcitx-candidate')
   for (let i = 0; i < allCandidates.length; ++i) {
     if (allCandidates[i] === target) {
-      return i
+      return getRenderedStart() + i // Scroll mode renders only rows in view.
     }
   }
   return -1
@@ -229,6 +248,16 @@ let receiver: HTMLElement
 export function initUx() {
   receiver = (window.fcitx.distribution === 'fcitx5-js' ? decoration : document) as HTMLElement
 
+  // Follow size changes that come without a show(), e.g. scroll animation, contextmenu, and fonts
+  // or images loaded late. Layout is up to date in the callback, so measuring forces none.
+  const resizeObserver = new ResizeObserver(() => {
+    if (!theme.classList.contains('fcitx-hidden')) {
+      resize(epoch, 0, 0, false, false)
+    }
+  })
+  resizeObserver.observe(decoration)
+  resizeObserver.observe(contextmenu)
+
   hoverables.addEventListener('mouseleave', () => {
     const hoverBehavior = getHoverBehavior()
     if (hoverBehavior === 'Move') {
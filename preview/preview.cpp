@@ -5,25 +5,161 @@
 #include <gtk/gtk.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
 
 std::unique_ptr<candidate_window::WebviewCandidateWindow> candidateWindow;
+// Opened by --windows after the first one, e.g. one per display.
+std::vector<std::unique_ptr<candidate_window::WebviewCandidateWindow>>
+    extraWindows;
 
-void doPreview() {
+// Of all processes on Linux, and of this one on macOS, whose web content
+// processes are not its children.
+size_t residentKB() {
+    auto usage = candidateWindow->memory_usage();
+    return (usage.ui_process + usage.web_processes) / 1024;
+}
+
+void printFirstShow() {
+    const auto &stats = candidateWindow->latency_stats();
+    std::cout << "First show in " << stats.first_show_ns / 1000 << " us";
+    if (stats.prewarm_ns) {
+        std::cout << ", after prewarm of " << stats.prewarm_ns / 1000 << " us";
+    }
+    std::cout << std::endl;
+}
+
+// After the first show() has been resized.
+void reportFirstShow() {
+#ifdef __APPLE__
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC),
+                   dispatch_get_main_queue(), ^{
+                     printFirstShow();
+                   });
+#elif defined(__linux__)
+    g_timeout_add_seconds(
+        1,
+        [](gpointer) -> gboolean {
+            printFirstShow();
+            return G_SOURCE_REMOVE;
+        },
+        nullptr);
+#endif
+}
+
+void setSampleCandidates(candidate_window::WebviewCandidateWindow &window) {
+    window.set_layout(candidate_window::layout_t::horizontal);
+    window.set_paging_buttons(true, false, true);
+    window.set_candidates(
+        {{"<h1>防注入</h1>", "1", "注释", {{0, "<h1>防注入</h1>"}}},
+         {"候选词", "2", "", {{1, "删词"}, {2, "置顶"}}},
+         {"制\t表\t符\n多 空  格", "2", ""}},
+        0, candidate_window::scroll_state_t::none, false, false);
+    window.set_theme(candidate_window::theme_t::light);
+    window.set_native_blur(candidate_window::blur_t::system);
+}
+
+// Open windows one after another, and print how much memory each adds.
+void openWindows(int remaining, size_t lastKB) {
+    if (remaining == 0) {
+        return;
+    }
+    size_t index = extraWindows.size();
+    extraWindows.push_back(
+        std::make_unique<candidate_window::WebviewCandidateWindow>([=] {
+            auto &window = *extraWindows[index];
+            setSampleCandidates(window);
+            window.show(100, 300 + 100 * index, 18);
+            size_t kb = residentKB();
+            std::cout << "Window " << index + 2 << " adds "
+                      << (static_cast<double>(kb) - lastKB) / 1024
+                      << " MB, total " << kb / 1024 << " MB" << std::endl;
+            openWindows(remaining - 1, kb);
+        }));
+}
+
+#ifdef __linux__
+// Type a keystroke about every millisecond, hiding the panel after each word
+// and pausing for idle release now and then. Memory should stay flat.
+gboolean typeKeystroke(gpointer data) {
+    static const char *preedits[] = {"s", "sh", "shu", "shur", "shuru"};
+    static int typed = 0;
+    int keystrokes = GPOINTER_TO_INT(data);
+    candidateWindow->update_input_panel({{preedits[typed % 5], 0}},
+                                        typed % 5 + 1, {}, {});
+    std::vector<candidate_window::Candidate> candidates;
+    for (int i = 0; i < 5 + typed % 6; ++i) {
+        candidates.push_back({"候选" + std::to_string(typed % 1000 + i),
+                              std::to_string(i + 1), "", {}});
+    }
+    candidateWindow->set_candidates(std::move(candidates), 0,
+                                    candidate_window::scroll_state_t::none,
+                                    false, false);
+    candidateWindow->show(100, 200, 18);
+    if (++typed % 5 == 0) {
+        candidateWindow->hide();
+    }
+    if (typed == keystrokes) {
+        gtk_main_quit();
+        return G_SOURCE_REMOVE;
+    }
+    if (typed % 10000 == 0) {
+        // Longer than idle_release below.
+        g_timeout_add_seconds(
+            2,
+            [](gpointer data) -> gboolean {
+                auto usage = candidateWindow->memory_usage();
+                std::cout << typed << " keystrokes: UI "
+                          << usage.ui_process / 1024 << " KB, web "
+                          << usage.web_processes / 1024 << " KB"
+                          << std::endl;
+                g_timeout_add(1, typeKeystroke, data);
+                return G_SOURCE_REMOVE;
+            },
+            data);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+void doPreview(bool prewarm, int windows, int soak, const std::string &trace) {
     candidateWindow =
         std::make_unique<candidate_window::WebviewCandidateWindow>([=]() {
-            std::cout << "Window loaded" << std::endl;
-            candidateWindow->set_layout(candidate_window::layout_t::horizontal);
-            candidateWindow->set_paging_buttons(true, false, true);
-            candidateWindow->set_candidates(
-                {{"<h1>防注入</h1>", "1", "注释", {{0, "<h1>防注入</h1>"}}},
-                 {"候选词", "2", "", {{1, "删词"}, {2, "置顶"}}},
-                 {"制\t表\t符\n多 空  格", "2", ""}},
-                0, candidate_window::scroll_state_t::none, false, false);
-            candidateWindow->set_theme(candidate_window::theme_t::light);
-            candidateWindow->set_native_blur(candidate_window::blur_t::system);
-            candidateWindow->show(100, 200, 18);
+            std::cout << "Window loaded in "
+                      << candidateWindow->latency_stats().load_ns / 1000000
+                      << " ms" << std::endl;
+            setSampleCandidates(*candidateWindow);
+            auto show = [=] {
+#ifdef __linux__
+                if (soak) {
+                    candidateWindow->set_memory_policy(
+                        {std::chrono::seconds(1), 0});
+                    g_timeout_add(1, typeKeystroke, GINT_TO_POINTER(soak));
+                    return;
+                }
+#endif
+                candidateWindow->show(100, 200, 18);
+                reportFirstShow();
+                if (windows > 1) {
+                    size_t kb = residentKB();
+                    std::cout << "Window 1 takes " << kb / 1024 << " MB"
+                              << std::endl;
+                    openWindows(windows - 1, kb);
+                }
+            };
+            if (prewarm) {
+                candidateWindow->prewarm(show);
+            } else {
+                show();
+            }
         });
+    if (!trace.empty() && !candidateWindow->start_recording(trace)) {
+        std::cerr << "Cannot record to " << trace << std::endl;
+    }
     candidateWindow->set_select_callback(
         [](int index) { std::cout << "selected " << index << std::endl; });
     candidateWindow->set_page_callback([](bool next) {
@@ -35,15 +171,35 @@ void doPreview() {
 }
 
 int main(int argc, char *argv[]) {
+    // Compare first show latency with and without --prewarm.
+    bool prewarm = false;
+    // Measure memory of each additional window with --windows N.
+    int windows = 1;
+    // Type N keystrokes and print memory with --soak N. Linux only.
+    int soak = 0;
+    // Record the session for replay with --record PATH.
+    std::string trace;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--prewarm") {
+            prewarm = true;
+        } else if (arg == "--windows" && i + 1 < argc) {
+            windows = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--soak" && i + 1 < argc) {
+            soak = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--record" && i + 1 < argc) {
+            trace = argv[++i];
+        }
+    }
 #ifdef __APPLE__
     @autoreleasepool {
         NSApplication *application = [NSApplication sharedApplication];
-        doPreview();
+        doPreview(prewarm, windows, soak, trace);
         [application run];
     }
 #elif defined(__linux__)
     gtk_init(&argc, &argv);
-    doPreview();
+    doPreview(prewarm, windows, soak, trace);
     gtk_main();
 #endif
     return 0;
@@ -0,0 +1,300 @@
+#include "webview_candidate_window.hpp"
+#ifdef __APPLE__
+#import <Cocoa/Cocoa.h>
+#elif defined(__linux__)
+#include <gtk/gtk.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace candidate_window;
+
+// Play back a trace recorded by WebviewCandidateWindow::start_recording, at
+// original speed or as fast as possible, and report latency of frames.
+//
+// With a window, calls recorded from the page are skipped, as the live page
+// makes its own. With --headless, the window talks to a StubBridge and calls
+// from the page are replayed instead, except onload, which replay does
+// itself, and resize, whose epoch belongs to the recorded session.
+
+struct Record {
+    latency_clock::duration delay;
+    TraceKind kind;
+    std::string call; // Of js_call.
+    std::function<void(WebviewCandidateWindow &)> apply;
+};
+
+std::unique_ptr<WebviewCandidateWindow> candidateWindow;
+StubBridge *stub = nullptr;
+std::vector<Record> records;
+bool maxSpeed = false;
+size_t next = 0;
+latency_clock::time_point started;
+latency_clock::time_point due;
+uint64_t frames = 0;
+// Of show() and what it dispatches to the main thread. Headless only, as
+// show_to_resize of a StubBridge only repeats what was recorded.
+LatencyHistogram frameCost;
+
+// Read arguments of types Args and call f(window, args...) on replay.
+template <typename... Args, typename F>
+bool decode(TraceReader &reader, Record &record, F f) {
+    std::tuple<Args...> args;
+    if (!std::apply([&](auto &...a) { return (reader.read(a) && ...); },
+                    args)) {
+        return false;
+    }
+    record.apply = [args = std::move(args),
+                    f](WebviewCandidateWindow &window) mutable {
+        std::apply([&](auto &...a) { f(window, std::move(a)...); }, args);
+    };
+    return true;
+}
+
+bool decode(TraceReader &reader, Record &record) {
+    switch (record.kind) {
+    case TraceKind::update_input_panel:
+        return decode<formatted, int, formatted, formatted>(
+            reader, record, [](auto &w, auto... a) {
+                w.update_input_panel(std::move(a)...);
+            });
+    case TraceKind::set_candidates:
+        return decode<std::vector<Candidate>, int, scroll_state_t, bool,
+                      bool>(reader, record, [](auto &w, auto... a) {
+            w.set_candidates(std::move(a)...);
+        });
+    case TraceKind::set_layout:
+        return decode<layout_t>(reader, record,
+                                [](auto &w, auto a) { w.set_layout(a); });
+    case TraceKind::set_writing_mode:
+        return decode<writing_mode_t>(
+            reader, record, [](auto &w, auto a) { w.set_writing_mode(a); });
+    case TraceKind::set_paging_buttons:
+        return decode<bool, bool, bool>(
+            reader, record,
+            [](auto &w, auto... a) { w.set_paging_buttons(a...); });
+    case TraceKind::show:
+        return decode<double, double, double>(
+            reader, record, [](auto &w, auto... a) { w.show(a...); });
+    case TraceKind::hide:
+        return decode<>(reader, record, [](auto &w) { w.hide(); });
+    case TraceKind::scroll_key_action:
+        return decode<scroll_key_action_t>(
+            reader, record, [](auto &w, auto a) { w.scroll_key_action(a); });
+    case TraceKind::set_style:
+        return decode<std::string>(reader, record, [](auto &w, auto a) {
+            w.set_style(a.c_str());
+        });
+    case TraceKind::set_theme:
+        return decode<theme_t>(reader, record,
+                               [](auto &w, auto a) { w.set_theme(a); });
+    case TraceKind::js_call:
+        return reader.read(record.call);
+    }
+    return false;
+}
+
+bool loadTrace(const std::string &path) {
+    TraceReader reader;
+    if (!reader.open(path)) {
+        std::cerr << path << " is not a trace" << std::endl;
+        return false;
+    }
+    uint64_t delay_us;
+    TraceKind kind;
+    while (reader.next(delay_us, kind)) {
+        Record record{std::chrono::microseconds(delay_us), kind, {}, {}};
+        if (!decode(reader, record)) {
+            std::cerr << "Truncated record " << records.size() << std::endl;
+            return false;
+        }
+        records.push_back(std::move(record));
+    }
+    return true;
+}
+
+void printHistogram(std::string_view name, const LatencyHistogram &h) {
+    if (!h.count()) {
+        return;
+    }
+    std::cout << name << ": " << h.count() << " times, p50 "
+              << h.quantile_ns(0.5) / 1000 << " us, p99 "
+              << h.quantile_ns(0.99) / 1000 << " us, max " << h.max_ns() / 1000
+              << " us" << std::endl;
+}
+
+void report() {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        latency_clock::now() - started);
+    const auto &stats = candidateWindow->latency_stats();
+    std::cout << "Replayed " << records.size() << " records, " << frames
+              << " frames in " << elapsed.count() << " ms" << std::endl;
+    if (stub) {
+        printHistogram("Frame", frameCost);
+    } else {
+        printHistogram("Frame (show to resize)", stats.show_to_resize);
+        std::cout << "Stale resizes: " << stats.stale_resizes << std::endl;
+    }
+    for (const auto &[name, h] : stats.invoke_js) {
+        printHistogram(name, h);
+    }
+}
+
+// Whether a call from the page is replayed.
+bool replays(std::string_view call) {
+    return stub && !call.starts_with(R"(["onload")") &&
+           !call.starts_with(R"(["resize")");
+}
+
+void play(const Record &record) {
+    if (record.kind == TraceKind::js_call) {
+        if (replays(record.call)) {
+            stub->call("fcitx", record.call);
+        }
+        return;
+    }
+    if (record.kind != TraceKind::show) {
+        record.apply(*candidateWindow);
+        return;
+    }
+    ++frames;
+    auto start = latency_clock::now();
+    record.apply(*candidateWindow);
+    if (stub) {
+        stub->run_pending();
+        frameCost.record(latency_clock::now() - start);
+    }
+}
+
+void runHeadless() {
+    for (const auto &record : records) {
+        if (!maxSpeed) {
+            due += record.delay;
+            std::this_thread::sleep_until(due);
+        }
+        play(record);
+        stub->run_pending();
+    }
+    report();
+}
+
+void later(latency_clock::duration delay, void (*f)()) {
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(delay).count();
+#ifdef __APPLE__
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+                                 std::max<int64_t>(ms, 0) * NSEC_PER_MSEC),
+                   dispatch_get_main_queue(), ^{
+                     f();
+                   });
+#elif defined(__linux__)
+    auto callback = [](gpointer data) -> gboolean {
+        reinterpret_cast<void (*)()>(data)();
+        return G_SOURCE_REMOVE;
+    };
+    // Idle priority lets WebKit and GTK keep up at maximum speed.
+    if (ms <= 0) {
+        g_idle_add(callback, reinterpret_cast<gpointer>(f));
+    } else {
+        g_timeout_add(static_cast<guint>(ms), callback,
+                      reinterpret_cast<gpointer>(f));
+    }
+#endif
+}
+
+void quit() {
+    report();
+#ifdef __APPLE__
+    [NSApp terminate:nil];
+#elif defined(__linux__)
+    gtk_main_quit();
+#endif
+}
+
+// Play records that are due, and schedule the rest.
+void playNative() {
+    while (next < records.size()) {
+        const auto &record = records[next];
+        if (!maxSpeed) {
+            auto now = latency_clock::now();
+            if (due + record.delay > now) {
+                later(due + record.delay - now, playNative);
+                return;
+            }
+            due += record.delay;
+        }
+        ++next;
+        play(record);
+        if (maxSpeed) {
+            later({}, playNative);
+            return;
+        }
+    }
+    // Let the last resize arrive.
+    later(std::chrono::seconds(1), quit);
+}
+
+void replay(bool headless) {
+    auto onload = [] {
+        started = due = latency_clock::now();
+        if (!stub) {
+            playNative();
+        }
+    };
+    if (!headless) {
+        candidateWindow = std::make_unique<WebviewCandidateWindow>(onload);
+        return;
+    }
+    auto bridge = std::make_unique<StubBridge>();
+    stub = bridge.get();
+    stub->record_evals = false;
+    candidateWindow =
+        std::make_unique<WebviewCandidateWindow>(std::move(bridge), onload);
+    stub->call("fcitx", R"(["onload"])");
+    // Not from onload, as calls from the page don't nest.
+    runHeadless();
+}
+
+int main(int argc, char *argv[]) {
+    bool headless = false;
+    std::string path;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--max-speed") {
+            maxSpeed = true;
+        } else if (arg == "--headless") {
+            headless = true;
+        } else {
+            path = arg;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--max-speed] [--headless] trace"
+                  << std::endl;
+        return 1;
+    }
+    if (!loadTrace(path)) {
+        return 1;
+    }
+    if (headless) {
+        replay(true);
+        return 0;
+    }
+#ifdef __APPLE__
+    @autoreleasepool {
+        NSApplication *application = [NSApplication sharedApplication];
+        replay(false);
+        [application run];
+    }
+#elif defined(__linux__)
+    gtk_init(&argc, &argv);
+    replay(false);
+    gtk_main();
+#endif
+    return 0;
+}
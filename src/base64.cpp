@@ -0,0 +1,323 @@
+#include "base64.hpp"
+#include <array>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#endif
+
+static const char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0xFF for bytes out of the alphabet.
+static constexpr auto kDecode = [] {
+    std::array<uint8_t, 256> table{};
+    table.fill(0xFF);
+    for (int i = 0; i < 64; ++i) {
+        table[static_cast<uint8_t>(kAlphabet[i])] = i;
+    }
+    return table;
+}();
+
+// Vectorized implementations take a prefix of whole blocks, and return how
+// many bytes (encode) or chars (decode) they consumed. Scalar code does the
+// rest, including any block rejected by the decoder, to report the error.
+using encode_blocks_t = size_t (*)(const uint8_t *src, size_t n, char *dst);
+using decode_blocks_t = size_t (*)(const char *src, size_t n, uint8_t *dst);
+
+static void encode_scalar(const uint8_t *src, size_t n, char *dst) {
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3, dst += 4) {
+        uint32_t v = src[i] << 16 | src[i + 1] << 8 | src[i + 2];
+        dst[0] = kAlphabet[v >> 18];
+        dst[1] = kAlphabet[v >> 12 & 0x3F];
+        dst[2] = kAlphabet[v >> 6 & 0x3F];
+        dst[3] = kAlphabet[v & 0x3F];
+    }
+    if (i < n) {
+        uint32_t v = src[i] << 16 | (i + 1 < n ? src[i + 1] << 8 : 0);
+        dst[0] = kAlphabet[v >> 18];
+        dst[1] = kAlphabet[v >> 12 & 0x3F];
+        dst[2] = i + 1 < n ? kAlphabet[v >> 6 & 0x3F] : '=';
+        dst[3] = '=';
+    }
+}
+
+// n is without padding. Returns bytes written, or -1 if invalid.
+static ptrdiff_t decode_scalar(const char *src, size_t n, uint8_t *dst) {
+    uint8_t *start = dst;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, dst += 3) {
+        uint8_t a = kDecode[static_cast<uint8_t>(src[i])];
+        uint8_t b = kDecode[static_cast<uint8_t>(src[i + 1])];
+        uint8_t c = kDecode[static_cast<uint8_t>(src[i + 2])];
+        uint8_t d = kDecode[static_cast<uint8_t>(src[i + 3])];
+        if ((a | b | c | d) & 0xC0) {
+            return -1;
+        }
+        uint32_t v = a << 18 | b << 12 | c << 6 | d;
+        dst[0] = v >> 16;
+        dst[1] = v >> 8;
+        dst[2] = v;
+    }
+    if (size_t rest = n - i) {
+        // 1 char holds less than a byte.
+        if (rest == 1) {
+            return -1;
+        }
+        uint8_t a = kDecode[static_cast<uint8_t>(src[i])];
+        uint8_t b = kDecode[static_cast<uint8_t>(src[i + 1])];
+        uint8_t c = rest == 3 ? kDecode[static_cast<uint8_t>(src[i + 2])] : 0;
+        if ((a | b | c) & 0xC0) {
+            return -1;
+        }
+        uint32_t v = a << 18 | b << 12 | c << 6;
+        *dst++ = v >> 16;
+        if (rest == 3) {
+            *dst++ = v >> 8;
+        }
+    }
+    return dst - start;
+}
+
+#ifdef BASE64_X86
+// Algorithms by Wojciech Muła, http://0x80.pl/articles/index.html#base64,
+// as in https://github.com/aklomp/base64.
+
+// Spread 12 bytes into 16 6-bit indices, one per byte.
+__attribute__((target("ssse3"))) static inline __m128i
+enc_reshuffle(__m128i in) {
+    in = _mm_shuffle_epi8(
+        in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+// Map indices to the alphabet by adding the offset of their range.
+__attribute__((target("ssse3"))) static inline __m128i
+enc_translate(__m128i in) {
+    const __m128i lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i range = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+    range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(lut, range), in);
+}
+
+__attribute__((target("ssse3"))) static size_t
+encode_ssse3(const uint8_t *src, size_t n, char *dst) {
+    size_t i = 0;
+    // Loads 16 bytes to use 12.
+    for (; i + 16 <= n; i += 12, dst += 16) {
+        __m128i in =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                         enc_translate(enc_reshuffle(in)));
+    }
+    return i;
+}
+
+// Validate 16 chars and turn them into 6-bit values. False if any is out of
+// the alphabet.
+__attribute__((target("ssse3"))) static inline bool dec_translate(__m128i &in) {
+    const __m128i lut_lo =
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi =
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                           0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (_mm_movemask_epi8(
+            _mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()))) {
+        return false;
+    }
+    __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+    __m128i roll =
+        _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+    return true;
+}
+
+// Pack 16 6-bit values into the first 12 bytes.
+__attribute__((target("ssse3"))) static inline __m128i
+dec_reshuffle(__m128i in) {
+    __m128i merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                               13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3"))) static size_t
+decode_ssse3(const char *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    // Stores 16 bytes of which 12 are valid.
+    for (; i + 16 <= n; i += 16, dst += 12) {
+        __m128i in =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        if (!dec_translate(in)) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), dec_reshuffle(in));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+encode_avx2(const uint8_t *src, size_t n, char *dst) {
+    const __m256i shuffle = _mm256_broadcastsi128_si256(
+        _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+    size_t i = 0;
+    // Each lane loads 16 bytes to use 12, so 28 are read for 24.
+    for (; i + 28 <= n; i += 24, dst += 32) {
+        __m128i lo =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i hi =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 12));
+        __m256i in =
+            _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        in = _mm256_or_si256(t1, t3);
+        __m256i range = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), in);
+        range = _mm256_or_si256(range,
+                                _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i *>(dst),
+            _mm256_add_epi8(_mm256_shuffle_epi8(lut, range), in));
+    }
+    return i + encode_ssse3(src + i, n - i, dst);
+}
+
+__attribute__((target("avx2"))) static size_t
+decode_avx2(const char *src, size_t n, uint8_t *dst) {
+    const __m256i lut_lo = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A));
+    const __m256i lut_hi = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+    size_t i = 0;
+    // Stores 32 bytes of which 24 are valid.
+    for (; i + 32 <= n; i += 32, dst += 24) {
+        __m256i in =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i hi_nibbles =
+            _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+        __m256i lo_nibbles = _mm256_and_si256(in, mask_2f);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            break;
+        }
+        __m256i eq_2f = _mm256_cmpeq_epi8(in, mask_2f);
+        __m256i roll =
+            _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        in = _mm256_add_epi8(in, roll);
+        __m256i merged =
+            _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+        __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        out = _mm256_shuffle_epi8(out, pack);
+        out = _mm256_permutevar8x32_epi32(
+            out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), out);
+    }
+    return i + decode_ssse3(src + i, n - i, dst);
+}
+#endif
+
+struct Codec {
+    const char *name;
+    encode_blocks_t encode;
+    decode_blocks_t decode;
+};
+
+static const Codec &codec() {
+    static const Codec codec = [] {
+#ifdef BASE64_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Codec{"avx2", encode_avx2, decode_avx2};
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return Codec{"ssse3", encode_ssse3, decode_ssse3};
+        }
+#endif
+        return Codec{"scalar", nullptr, nullptr};
+    }();
+    return codec;
+}
+
+static void encode_with(encode_blocks_t blocks, std::string_view in,
+                        std::string &out) {
+    size_t start = out.size();
+    out.resize(start + (in.size() + 2) / 3 * 4);
+    auto src = reinterpret_cast<const uint8_t *>(in.data());
+    char *dst = out.data() + start;
+    size_t done = blocks ? blocks(src, in.size(), dst) : 0;
+    encode_scalar(src + done, in.size() - done, dst + done / 3 * 4);
+}
+
+static bool decode_with(decode_blocks_t blocks, std::string_view in,
+                        std::string &out) {
+    size_t n = in.size();
+    size_t padding = 0;
+    while (padding < 2 && padding < n && in[n - 1 - padding] == '=') {
+        ++padding;
+    }
+    if (padding && n % 4) {
+        return false;
+    }
+    n -= padding;
+    size_t start = out.size();
+    // Vector stores overrun by up to 8 bytes.
+    out.resize(start + n / 4 * 3 + 2 + 8);
+    auto dst = reinterpret_cast<uint8_t *>(out.data() + start);
+    size_t done = blocks ? blocks(in.data(), n, dst) : 0;
+    ptrdiff_t written = decode_scalar(in.data() + done, n - done,
+                                      dst + done / 4 * 3);
+    if (written < 0) {
+        return false;
+    }
+    out.resize(start + done / 4 * 3 + written);
+    return true;
+}
+
+void base64_encode(std::string_view in, std::string &out) {
+    encode_with(codec().encode, in, out);
+}
+
+bool base64_decode(std::string_view in, std::string &out) {
+    return decode_with(codec().decode, in, out);
+}
+
+const char *base64_isa() { return codec().name; }
+
+void base64_encode_scalar(std::string_view in, std::string &out) {
+    encode_with(nullptr, in, out);
+}
+
+bool base64_decode_scalar(std::string_view in, std::string &out) {
+    return decode_with(nullptr, in, out);
+}
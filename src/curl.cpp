@@ -1,17 +1,22 @@
 #include "curl.hpp"
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <errno.h>
+#include <fcntl.h>
 #include <mutex>
 #include <stdexcept>
+#include <strings.h>
 #include <thread>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <sys/event.h>
+#endif
 
-static size_t _on_data_cb(char *data, size_t size, size_t nmemb,
-                          std::string *outbuf);
 static bool write_char_strong(int fd, char c);
-static bool read_char_strong(int fd, char *c);
-std::mutex m;
 std::atomic<bool> running;
 
 CurlMultiManager &CurlMultiManager::shared() {
@@ -19,7 +24,7 @@ CurlMultiManager &CurlMultiManager::shared() {
     return instance;
 }
 
-CurlMultiManager::CurlMultiManager() {
+CurlMultiManager::CurlMultiManager(CurlLimits limits) : limits(limits) {
     bool expected = false;
     if (!running.compare_exchange_strong(expected, true)) {
         throw std::runtime_error("should only run one curl manager");
@@ -27,93 +32,479 @@ CurlMultiManager::CurlMultiManager() {
     if (pipe(controlfd) < 0) {
         throw std::runtime_error("failed to create curl control pipe");
     }
+    // Drained on every wakeup, as a write only means "look at the queue".
+    fcntl(controlfd[0], F_SETFL, O_NONBLOCK);
+#ifdef __linux__
+    pollfd = epoll_create1(EPOLL_CLOEXEC);
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pollfd < 0 || timerfd < 0) {
+        throw std::runtime_error("failed to create curl event loop");
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = controlfd[0];
+    epoll_ctl(pollfd, EPOLL_CTL_ADD, controlfd[0], &ev);
+    ev.data.fd = timerfd;
+    epoll_ctl(pollfd, EPOLL_CTL_ADD, timerfd, &ev);
+#else
+    pollfd = kqueue();
+    if (pollfd < 0) {
+        throw std::runtime_error("failed to create curl event loop");
+    }
+    struct kevent ev;
+    EV_SET(&ev, controlfd[0], EVFILT_READ, EV_ADD, 0, 0, nullptr);
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+#endif
     curl_global_init(CURL_GLOBAL_ALL);
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC,
+                      +[](CURL *, curl_lock_data data, curl_lock_access,
+                          void *userp) {
+                          static_cast<CurlMultiManager *>(userp)
+                              ->share_locks[data]
+                              .lock();
+                      });
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC,
+                      +[](CURL *, curl_lock_data data, void *userp) {
+                          static_cast<CurlMultiManager *>(userp)
+                              ->share_locks[data]
+                              .unlock();
+                      });
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
     multi = curl_multi_init();
+    // Beyond these, curl queues transfers by itself, first come first served.
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      limits.max_connections);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      limits.max_host_connections);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, on_socket);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, on_timer);
+    curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
     worker_thread = std::thread(&CurlMultiManager::run, this);
 }
 
 CurlMultiManager::~CurlMultiManager() {
+    quitting = true;
     write_char_strong(controlfd[1], 'q');
     if (worker_thread.joinable()) {
         worker_thread.join();
     }
+    cleanup_all();
     curl_multi_cleanup(multi);
+    for (auto easy : pool) {
+        curl_easy_cleanup(easy);
+    }
+    curl_share_cleanup(share);
     curl_global_cleanup();
     close(controlfd[0]);
     close(controlfd[1]);
+    close(pollfd);
+#ifdef __linux__
+    close(timerfd);
+#endif
     running.store(false);
 }
 
-void CurlMultiManager::add(CURL *easy, CurlMultiManager::Callback callback) {
-    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, _on_data_cb);
-    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &buf[easy]);
+uint64_t CurlMultiManager::add(CURL *easy, CurlMultiManager::Callback callback,
+                               DataCallback on_data, CurlPriority priority) {
+    auto request = requests.create();
+    uint64_t id = ++next_id;
+    request->submit = {nullptr, Command::kAdd, id, request};
+    request->easy = easy;
+    request->cb = std::move(callback);
+    request->on_data = std::move(on_data);
+    request->priority = static_cast<size_t>(priority);
+    request->queued = std::chrono::steady_clock::now();
+    // easy is only touched by this thread until submitted.
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, request);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_data);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, request);
+    submit(&request->submit);
+    return id;
+}
+
+void CurlMultiManager::cancel(uint64_t id) {
+    submit(new Command{nullptr, Command::kCancel, id});
+}
+
+void CurlMultiManager::resume(uint64_t id) {
+    submit(new Command{nullptr, Command::kResume, id});
+}
+
+void CurlMultiManager::submit(Command *command) {
+    // The worker takes all commands on wakeup, so only the first since then
+    // needs to wake it.
+    if (submissions.push(command)) {
+        write_char_strong(controlfd[1], 'c');
+    }
+}
+
+void CurlMultiManager::set_dispatch(
+    std::function<void(std::function<void()>)> dispatch) {
+    std::lock_guard g(dispatch_mutex);
+    this->dispatch = std::move(dispatch);
+}
+
+CURL *CurlMultiManager::acquire() {
+    CURL *easy = nullptr;
+    {
+        std::lock_guard g(pool_mutex);
+        ++stats.acquired;
+        if (!pool.empty()) {
+            easy = pool.back();
+            pool.pop_back();
+            ++stats.reused;
+        }
+    }
+    if (!easy) {
+        easy = curl_easy_init();
+    }
+    if (easy) {
+        curl_easy_setopt(easy, CURLOPT_SHARE, share);
+    }
+    return easy;
+}
+
+void CurlMultiManager::release(CURL *easy) {
+    // Keeps caches and live connections, but clears options.
+    curl_easy_reset(easy);
     {
-        std::unique_lock g(m);
-        buf[easy] = "";
-        cb[easy] = callback;
-        curl_multi_add_handle(multi, easy);
+        std::lock_guard g(pool_mutex);
+        if (pool.size() < kMaxPooled) {
+            pool.push_back(easy);
+            return;
+        }
+    }
+    curl_easy_cleanup(easy);
+}
+
+CurlPoolStats CurlMultiManager::pool_stats() {
+    std::lock_guard g(pool_mutex);
+    return stats;
+}
+
+std::array<CurlQueueStats, kCurlPriorities> CurlMultiManager::queue_stats() {
+    std::lock_guard g(pool_mutex);
+    return queue;
+}
+
+void CurlMultiManager::record_transfer(CURL *easy) {
+    long connects = 0;
+    char *scheme = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(easy, CURLINFO_SCHEME, &scheme);
+    bool tls = scheme && strncasecmp(scheme, "https", 6) == 0;
+    std::lock_guard g(pool_mutex);
+    ++stats.transfers;
+    if (connects == 0) {
+        ++stats.connections_reused;
+        stats.handshakes_avoided += tls;
+    }
+}
+
+// libcurl tells which sockets to watch and for what.
+int CurlMultiManager::on_socket(CURL *, curl_socket_t s, int what,
+                                void *userp, void *socketp) {
+    auto self = static_cast<CurlMultiManager *>(userp);
+    self->watch(s, what, socketp != nullptr);
+    if (what == CURL_POLL_REMOVE) {
+        curl_multi_assign(self->multi, s, nullptr);
+    } else if (!socketp) {
+        // Any non-null value, to know it's added next time.
+        curl_multi_assign(self->multi, s, self);
+    }
+    return 0;
+}
+
+// libcurl tells when to call socket_action with CURL_SOCKET_TIMEOUT.
+int CurlMultiManager::on_timer(CURLM *, long timeout_ms, void *userp) {
+    static_cast<CurlMultiManager *>(userp)->set_timer(timeout_ms);
+    return 0;
+}
+
+#ifdef __linux__
+void CurlMultiManager::watch(curl_socket_t s, int what, bool added) {
+    if (what == CURL_POLL_REMOVE) {
+        // May fail if curl already closed the socket, which removes it.
+        epoll_ctl(pollfd, EPOLL_CTL_DEL, s, nullptr);
+        return;
+    }
+    epoll_event ev{};
+    ev.events = (what & CURL_POLL_IN ? static_cast<uint32_t>(EPOLLIN) : 0) |
+                (what & CURL_POLL_OUT ? static_cast<uint32_t>(EPOLLOUT) : 0);
+    ev.data.fd = s;
+    if (epoll_ctl(pollfd, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s, &ev) < 0) {
+        // The fd number was reused after a close we weren't told about.
+        epoll_ctl(pollfd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s, &ev);
+    }
+}
+
+void CurlMultiManager::set_timer(long timeout_ms) {
+    itimerspec its{};
+    if (timeout_ms == 0) {
+        its.it_value.tv_nsec = 1; // As soon as possible, as 0 disarms.
+    } else if (timeout_ms > 0) {
+        its.it_value.tv_sec = timeout_ms / 1000;
+        its.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    timerfd_settime(timerfd, 0, &its, nullptr);
+}
+#else
+static constexpr uintptr_t kTimerIdent = 0;
+
+void CurlMultiManager::watch(curl_socket_t s, int what, bool) {
+    // Deleting a filter that isn't there fails harmlessly.
+    struct kevent ev;
+    EV_SET(&ev, s, EVFILT_READ,
+           what & CURL_POLL_IN && what != CURL_POLL_REMOVE ? EV_ADD
+                                                           : EV_DELETE,
+           0, 0, nullptr);
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+    EV_SET(&ev, s, EVFILT_WRITE,
+           what & CURL_POLL_OUT && what != CURL_POLL_REMOVE ? EV_ADD
+                                                            : EV_DELETE,
+           0, 0, nullptr);
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+}
+
+void CurlMultiManager::set_timer(long timeout_ms) {
+    struct kevent ev;
+    if (timeout_ms < 0) {
+        EV_SET(&ev, kTimerIdent, EVFILT_TIMER, EV_DELETE, 0, 0, nullptr);
+    } else {
+        EV_SET(&ev, kTimerIdent, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0,
+               timeout_ms, nullptr);
+    }
+    kevent(pollfd, &ev, 1, nullptr, 0, nullptr);
+}
+#endif
+
+void CurlMultiManager::run_commands() {
+    for (Command *command = submissions.take_all(); command;) {
+        Command *next = command->next;
+        switch (command->op) {
+        case Command::kAdd:
+            live[command->id] = command->request;
+            waiting[command->request->priority].push_back(command->request);
+            break;
+        case Command::kCancel:
+        case Command::kResume:
+            // It may have finished, or even been cancelled twice.
+            if (auto iter = live.find(command->id); iter != live.end()) {
+                Request *request = iter->second;
+                if (command->op == Command::kResume) {
+                    if (request->admitted) {
+                        curl_easy_pause(request->easy, CURLPAUSE_CONT);
+                    }
+                } else {
+                    live.erase(iter);
+                    if (request->admitted) {
+                        curl_multi_remove_handle(multi, request->easy);
+                        --transfers[request->priority];
+                    } else {
+                        std::erase(waiting[request->priority], request);
+                    }
+                    request->result = CURLE_ABORTED_BY_CALLBACK;
+                    complete(request);
+                }
+            }
+            delete command;
+            break;
+        }
+        command = next;
+    }
+}
+
+// Strictly by priority: nothing is admitted while a request of a higher
+// priority waits.
+void CurlMultiManager::admit() {
+    for (size_t priority = 0; priority < kCurlPriorities; ++priority) {
+        auto &lane = waiting[priority];
+        while (!lane.empty()) {
+            size_t busy = 0;
+            for (size_t p = priority; p < kCurlPriorities; ++p) {
+                busy += transfers[p];
+            }
+            if (busy >= limits.max_transfers[priority]) {
+                return;
+            }
+            Request *request = lane.front();
+            lane.pop_front();
+            request->admitted = true;
+            ++transfers[priority];
+            // Sets a 0 timeout to kick off the transfer.
+            curl_multi_add_handle(multi, request->easy);
+            std::chrono::duration<double, std::milli> delay =
+                std::chrono::steady_clock::now() - request->queued;
+            std::lock_guard g(pool_mutex);
+            auto &stats = queue[priority];
+            ++stats.admitted;
+            stats.total_ms += delay.count();
+            stats.max_ms = std::max(stats.max_ms, delay.count());
+        }
     }
-    std::atomic_thread_fence(std::memory_order_release);
-    write_char_strong(controlfd[1], 'a');
 }
 
 void CurlMultiManager::run() {
+    constexpr int kMaxEvents = 64;
+    int still_running = 0;
     while (true) {
-        int still_running = 0;
-        int ret;
-        ret = curl_multi_perform(multi, &still_running);
-        int numfds;
-        struct curl_waitfd wfd;
-        wfd.fd = controlfd[0];
-        wfd.events = CURL_WAIT_POLLIN;
-        wfd.revents = 0;
-        // NOTE: poll does not return when any of the easy handle's
-        // timeout expires.  By setting poll's timeout to 50ms, we
-        // effectively set the timeout precision to 50ms.
-        curl_multi_poll(multi, &wfd, 1, 50, &numfds);
-        std::atomic_thread_fence(std::memory_order_acquire);
-        if (wfd.revents) {
-            char cmd;
-            read_char_strong(controlfd[0], &cmd);
-            switch (cmd) {
-            case 'q': // quit
-                return;
-            case 'a': // added a new handle
-                break;
-            default:
-                assert(false && "unreachable");
+#ifdef __linux__
+        epoll_event events[kMaxEvents];
+        int n = epoll_wait(pollfd, events, kMaxEvents, -1);
+#else
+        struct kevent events[kMaxEvents];
+        int n = kevent(pollfd, nullptr, 0, events, kMaxEvents, nullptr);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            assert(false && "curl event loop failed");
+            return;
         }
-        CURLMsg *msg;
-        int msgs_left;
-        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
-            if (msg->msg == CURLMSG_DONE) {
-                CURL *easy = msg->easy_handle;
-                CURLcode res = msg->data.result;
-                {
-                    // do this because the cb might be slow
-                    std::shared_lock g(m);
-                    try {
-                        cb[easy](res, easy, buf[easy]);
-                    } catch (...) {
-                        assert(false && "curl callback must not throw!");
-                    }
+        for (int i = 0; i < n; ++i) {
+#ifdef __linux__
+            int fd = events[i].data.fd;
+            bool timeout = fd == timerfd;
+            int flags = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) |
+                        (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0) |
+                        (events[i].events & (EPOLLERR | EPOLLHUP)
+                             ? CURL_CSELECT_ERR
+                             : 0);
+#else
+            int fd = static_cast<int>(events[i].ident);
+            bool timeout = events[i].filter == EVFILT_TIMER;
+            int flags = (events[i].filter == EVFILT_READ ? CURL_CSELECT_IN
+                                                         : 0) |
+                        (events[i].filter == EVFILT_WRITE ? CURL_CSELECT_OUT
+                                                          : 0) |
+                        (events[i].flags & EV_ERROR ? CURL_CSELECT_ERR : 0);
+#endif
+            if (timeout) {
+#ifdef __linux__
+                uint64_t expirations;
+                read(timerfd, &expirations, sizeof(expirations));
+#endif
+                curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0,
+                                         &still_running);
+            } else if (fd == controlfd[0]) {
+                char drain[64];
+                while (read(controlfd[0], drain, sizeof(drain)) > 0) {
                 }
-                {
-                    std::unique_lock g(m);
-                    cb.erase(easy);
-                    buf.erase(easy);
-                    curl_multi_remove_handle(multi, easy);
+                if (quitting) {
+                    return;
                 }
-                curl_easy_cleanup(easy);
+                // Finish what's done first so that it isn't cancelled.
+                check_done();
+                run_commands();
+            } else {
+                curl_multi_socket_action(multi, fd, flags, &still_running);
             }
         }
+        check_done();
+        admit();
+    }
+}
+
+void CurlMultiManager::check_done() {
+    CURLMsg *msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+        if (msg->msg == CURLMSG_DONE) {
+            CURL *easy = msg->easy_handle;
+            Request *request;
+            curl_easy_getinfo(easy, CURLINFO_PRIVATE, &request);
+            request->result = msg->data.result;
+            if (request->result == CURLE_OK) {
+                record_transfer(easy);
+            }
+            // msg is invalid after this.
+            curl_multi_remove_handle(multi, easy);
+            live.erase(request->submit.id);
+            --transfers[request->priority];
+            complete(request);
+        }
+    }
+}
+
+void CurlMultiManager::complete(Request *request) {
+    std::function<void(std::function<void()>)> run;
+    {
+        std::lock_guard g(dispatch_mutex);
+        run = dispatch;
+    }
+    if (!run) {
+        finish(request);
+        return;
+    }
+    completions.push(request);
+    // A drain for each completion, even if one is already on its way, as it
+    // may be dropped, e.g. by a bridge destroyed with tasks pending. Each
+    // takes all that's queued, so the extra ones cost a task that finds
+    // nothing.
+    run([this] { drain_completions(); });
+}
+
+void CurlMultiManager::drain_completions() {
+    for (Request *request = completions.take_all(); request;) {
+        Request *next = request->next;
+        finish(request);
+        request = next;
+    }
+}
+
+void CurlMultiManager::finish(Request *request) {
+    try {
+        request->cb(request->result, request->easy, request->buf);
+    } catch (...) {
+        assert(false && "curl callback must not throw!");
+    }
+    release(request->easy);
+    requests.destroy(request);
+}
+
+// Drop transfers on quit, without calling back.
+void CurlMultiManager::cleanup_all() {
+    auto drop = [this](Request *request) {
+        curl_multi_remove_handle(multi, request->easy);
+        curl_easy_cleanup(request->easy);
+        requests.destroy(request);
+    };
+    for (const auto &[id, request] : live) {
+        drop(request);
+    }
+    live.clear();
+    for (auto &lane : waiting) {
+        lane.clear();
+    }
+    for (Command *command = submissions.take_all(); command;) {
+        Command *next = command->next;
+        if (command->op == Command::kAdd) {
+            drop(command->request);
+        } else {
+            delete command;
+        }
+        command = next;
+    }
+    for (Request *request = completions.take_all(); request;) {
+        Request *next = request->next;
+        drop(request);
+        request = next;
     }
 }
 
-size_t _on_data_cb(char *data, size_t size, size_t nmemb, std::string *outbuf) {
+size_t CurlMultiManager::write_data(char *data, size_t size, size_t nmemb,
+                                    Request *request) {
     size_t realsize = size * nmemb;
-    outbuf->append(data, realsize);
+    if (request->on_data) {
+        return request->on_data(data, realsize);
+    }
+    request->buf.append(data, realsize);
     return realsize;
 }
 
@@ -124,11 +515,3 @@ static bool write_char_strong(int fd, char c) {
     } while (ret == -1 && errno == EINTR);
     return ret == 1;
 }
-
-static bool read_char_strong(int fd, char *c) {
-    ssize_t ret;
-    do {
-        ret = read(fd, c, 1);
-    } while (ret == -1 && errno == EINTR);
-    return ret == 1;
-}
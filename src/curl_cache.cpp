@@ -0,0 +1,345 @@
+#include "curl_cache.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static constexpr char kMagic[4] = {'F', 'W', 'C', 'C'};
+static constexpr uint32_t kVersion = 1;
+
+static int64_t now() { return static_cast<int64_t>(time(nullptr)); }
+
+static size_t entry_size(const std::string &key, const CachedResponse &r,
+                         std::string_view mapped) {
+    return key.size() + r.data.size() + mapped.size() + r.etag.size() +
+           r.last_modified.size();
+}
+
+#if LIBCURL_VERSION_NUM >= 0x075400
+static std::string response_header(CURL *easy, const char *name) {
+    struct curl_header *h;
+    if (curl_easy_header(easy, name, 0, CURLH_HEADER, -1, &h) == CURLHE_OK) {
+        return h->value;
+    }
+    return "";
+}
+#else
+// Response headers API is only in curl 7.84+; nothing is cached without it.
+static std::string response_header(CURL *, const char *) { return ""; }
+#endif
+
+// Fill expires and validators of r from response headers. Returns false if
+// the response must not be stored.
+static bool apply_freshness(CURL *easy, CachedResponse &r) {
+    std::string cache_control = response_header(easy, "Cache-Control");
+    std::transform(cache_control.begin(), cache_control.end(),
+                   cache_control.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    std::optional<int64_t> max_age;
+    bool no_cache = false;
+    size_t start = 0;
+    while (start < cache_control.size()) {
+        size_t end = cache_control.find(',', start);
+        if (end == std::string::npos) {
+            end = cache_control.size();
+        }
+        std::string directive = cache_control.substr(start, end - start);
+        directive.erase(0, directive.find_first_not_of(" \t"));
+        directive.erase(directive.find_last_not_of(" \t") + 1);
+        if (directive == "no-store") {
+            return false;
+        } else if (directive == "no-cache") {
+            no_cache = true;
+        } else if (directive.rfind("max-age=", 0) == 0) {
+            max_age = std::atoll(directive.c_str() + 8);
+        }
+        start = end + 1;
+    }
+
+    auto etag = response_header(easy, "ETag");
+    if (!etag.empty()) {
+        r.etag = etag;
+    }
+    auto last_modified = response_header(easy, "Last-Modified");
+    if (!last_modified.empty()) {
+        r.last_modified = last_modified;
+    }
+
+    int64_t t = now();
+    if (no_cache) {
+        r.expires = t;
+    } else if (max_age) {
+        int64_t age = std::atoll(response_header(easy, "Age").c_str());
+        r.expires = t + std::max<int64_t>(*max_age - age, 0);
+    } else if (auto expires = response_header(easy, "Expires");
+               !expires.empty()) {
+        time_t parsed = curl_getdate(expires.c_str(), nullptr);
+        r.expires = parsed < 0 ? t : parsed;
+    } else {
+        r.expires = t;
+    }
+    // Neither fresh nor revalidatable is useless.
+    return r.fresh(t) || r.revalidatable();
+}
+
+CurlCache &CurlCache::shared() {
+    static CurlCache instance;
+    return instance;
+}
+
+CurlCache::~CurlCache() {
+    save();
+    if (map) {
+        munmap(map, map_size);
+    }
+}
+
+std::string
+CurlCache::make_key(const std::string &method, const std::string &url,
+                    const std::unordered_map<std::string, std::string> &headers,
+                    const std::string &body) {
+    std::vector<std::pair<std::string, std::string>> sorted(headers.begin(),
+                                                            headers.end());
+    std::sort(sorted.begin(), sorted.end());
+    std::string key = method + '\n' + url + '\n';
+    for (const auto &[name, value] : sorted) {
+        key += name + ": " + value + '\n';
+    }
+    key += '\n';
+    key += body;
+    return key;
+}
+
+std::optional<CachedResponse> CurlCache::lookup(const std::string &key) {
+    std::lock_guard g(m);
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+        return std::nullopt;
+    }
+    lru.splice(lru.begin(), lru, iter->second);
+    auto &entry = iter->second->second;
+    read_body(entry);
+    return entry.response;
+}
+
+void CurlCache::store(const std::string &key, const std::string &method,
+                      CURL *easy, long status, const std::string &data) {
+    if (status != 200) {
+        return;
+    }
+    CachedResponse r;
+    r.status = status;
+    r.data = data;
+    if (!apply_freshness(easy, r)) {
+        return;
+    }
+    if (method != "GET") {
+        r.etag.clear();
+        r.last_modified.clear();
+        if (!r.fresh(now())) {
+            return;
+        }
+    }
+    std::lock_guard g(m);
+    insert(key, {std::move(r), {}});
+    if (!path.empty() && ++unsaved >= kSaveEvery) {
+        save_locked();
+    }
+}
+
+std::optional<CachedResponse> CurlCache::revalidate(const std::string &key,
+                                                    CURL *easy) {
+    std::lock_guard g(m);
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+        return std::nullopt;
+    }
+    read_body(iter->second->second);
+    auto &r = iter->second->second.response;
+    if (!apply_freshness(easy, r)) {
+        auto copy = std::move(r);
+        erase(iter->second);
+        return copy;
+    }
+    return r;
+}
+
+void CurlCache::set_capacity(size_t bytes) {
+    std::lock_guard g(m);
+    capacity = bytes;
+    evict();
+}
+
+void CurlCache::set_file(const std::string &path) {
+    std::lock_guard g(m);
+    unmap();
+    this->path = path;
+    if (!path.empty()) {
+        load();
+    }
+}
+
+void CurlCache::insert(std::string key, Entry entry) {
+    if (auto iter = index.find(key); iter != index.end()) {
+        erase(iter->second);
+    }
+    size_t size = entry_size(key, entry.response, entry.mapped);
+    if (size > capacity) {
+        return;
+    }
+    bytes += size;
+    lru.emplace_front(std::move(key), std::move(entry));
+    index[lru.front().first] = lru.begin();
+    evict();
+}
+
+void CurlCache::read_body(Entry &entry) {
+    if (!entry.mapped.empty()) {
+        entry.response.data.assign(entry.mapped);
+        entry.mapped = {};
+    }
+}
+
+void CurlCache::erase(Lru::iterator it) {
+    bytes -= entry_size(it->first, it->second.response, it->second.mapped);
+    index.erase(it->first);
+    lru.erase(it);
+}
+
+void CurlCache::evict() {
+    while (bytes > capacity && !lru.empty()) {
+        erase(std::prev(lru.end()));
+    }
+}
+
+// File layout: magic, version, then records of
+// u32 lengths of key, data, etag and last_modified, i64 status, i64 expires,
+// followed by the 4 strings. Least recently used first.
+template <typename T> static void write_pod(std::ofstream &out, T value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void CurlCache::save() {
+    std::lock_guard g(m);
+    save_locked();
+}
+
+void CurlCache::save_locked() {
+    if (path.empty()) {
+        return;
+    }
+    unsaved = 0;
+    // Write then rename so that a crash never leaves a truncated file.
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return;
+        }
+        out.write(kMagic, sizeof(kMagic));
+        write_pod(out, kVersion);
+        for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+            const auto &[key, entry] = *it;
+            const auto &r = entry.response;
+            std::string_view data = entry.mapped.empty()
+                                        ? std::string_view(r.data)
+                                        : entry.mapped;
+            write_pod(out, static_cast<uint32_t>(key.size()));
+            write_pod(out, static_cast<uint32_t>(data.size()));
+            write_pod(out, static_cast<uint32_t>(r.etag.size()));
+            write_pod(out, static_cast<uint32_t>(r.last_modified.size()));
+            write_pod(out, static_cast<int64_t>(r.status));
+            write_pod(out, r.expires);
+            out << key << data << r.etag << r.last_modified;
+        }
+        if (!out) {
+            return;
+        }
+    }
+    std::rename(tmp.c_str(), path.c_str());
+}
+
+// Only keys and headers are read on load. Bodies stay in the mapping until
+// looked up, so the pages of those never used are never read.
+void CurlCache::load() {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 8) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+    const char *p = static_cast<const char *>(mapping);
+    const char *end = p + size;
+    auto read_pod = [&](auto &value) {
+        if (end - p < static_cast<ptrdiff_t>(sizeof(value))) {
+            return false;
+        }
+        std::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return true;
+    };
+    auto read_view = [&](uint32_t length, std::string_view &s) {
+        if (static_cast<size_t>(end - p) < length) {
+            return false;
+        }
+        s = {p, length};
+        p += length;
+        return true;
+    };
+    bool magic = std::memcmp(p, kMagic, sizeof(kMagic)) == 0;
+    p += sizeof(kMagic);
+    uint32_t version = 0;
+    if (!magic || !read_pod(version) || version != kVersion) {
+        munmap(mapping, size);
+        return;
+    }
+    map = mapping;
+    map_size = size;
+    while (p < end) {
+        uint32_t key_length, data_length, etag_length, last_modified_length;
+        int64_t status;
+        std::string_view key, etag, last_modified;
+        Entry entry;
+        if (!read_pod(key_length) || !read_pod(data_length) ||
+            !read_pod(etag_length) || !read_pod(last_modified_length) ||
+            !read_pod(status) || !read_pod(entry.response.expires) ||
+            !read_view(key_length, key) ||
+            !read_view(data_length, entry.mapped) ||
+            !read_view(etag_length, etag) ||
+            !read_view(last_modified_length, last_modified)) {
+            break; // Truncated, keep what's read.
+        }
+        entry.response.status = static_cast<long>(status);
+        entry.response.etag = etag;
+        entry.response.last_modified = last_modified;
+        insert(std::string(key), std::move(entry));
+    }
+}
+
+void CurlCache::unmap() {
+    if (!map) {
+        return;
+    }
+    for (auto &[key, entry] : lru) {
+        read_body(entry);
+    }
+    munmap(map, map_size);
+    map = nullptr;
+    map_size = 0;
+}
@@ -0,0 +1,182 @@
+#include "deserializer.hpp"
+
+namespace candidate_window {
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && is_space(s.front())) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && is_space(s.back())) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+bool split_js_array(std::string_view s, std::vector<std::string_view> &out) {
+    out.clear();
+    s = trim(s);
+    if (s.size() < 2 || s.front() != '[' || s.back() != ']') {
+        return false;
+    }
+    s = s.substr(1, s.size() - 2);
+    if (trim(s).empty()) {
+        return true;
+    }
+    // Brackets and braces are counted together, which is enough to find
+    // top-level commas; mismatched ones are caught when read.
+    int depth = 0;
+    bool in_string = false;
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (in_string) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            continue;
+        }
+        switch (c) {
+        case '"':
+            in_string = true;
+            break;
+        case '[':
+        case '{':
+            ++depth;
+            break;
+        case ']':
+        case '}':
+            if (--depth < 0) {
+                return false;
+            }
+            break;
+        case ',':
+            if (depth == 0) {
+                auto element = trim(s.substr(start, i - start));
+                if (element.empty()) {
+                    return false;
+                }
+                out.push_back(element);
+                start = i + 1;
+            }
+            break;
+        }
+    }
+    auto element = trim(s.substr(start));
+    if (in_string || depth != 0 || element.empty()) {
+        return false;
+    }
+    out.push_back(element);
+    return true;
+}
+
+static void append_utf8(std::string &out, uint32_t code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// Read 4 hex digits at s[i].
+static bool read_hex4(std::string_view s, size_t i, uint32_t &code) {
+    if (i + 4 > s.size()) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(s.data() + i, s.data() + i + 4, code, 16);
+    return ec == std::errc() && end == s.data() + i + 4;
+}
+
+bool read_js_string(std::string_view s, std::string &out) {
+    if (s.size() < 2 || s.front() != '"' || s.back() != '"') {
+        return false;
+    }
+    s = s.substr(1, s.size() - 2);
+    out.clear();
+    out.reserve(s.size());
+    // Bytes in [run, i) need no unescaping and are appended in bulk.
+    size_t run = 0;
+    size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = s[i];
+        if (c == '"' || c < 0x20) {
+            return false;
+        }
+        if (c != '\\') {
+            ++i;
+            continue;
+        }
+        out.append(s.data() + run, i - run);
+        if (++i == s.size()) {
+            return false;
+        }
+        switch (s[i++]) {
+        case '"':
+            out += '"';
+            break;
+        case '\\':
+            out += '\\';
+            break;
+        case '/':
+            out += '/';
+            break;
+        case 'b':
+            out += '\b';
+            break;
+        case 'f':
+            out += '\f';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case 'r':
+            out += '\r';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'u': {
+            uint32_t code;
+            if (!read_hex4(s, i, code)) {
+                return false;
+            }
+            i += 4;
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                uint32_t low;
+                if (i + 1 < s.size() && s[i] == '\\' && s[i + 1] == 'u' &&
+                    read_hex4(s, i + 2, low) && low >= 0xDC00 &&
+                    low <= 0xDFFF) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                } else {
+                    code = 0xFFFD; // Lone high surrogate
+                }
+            } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                code = 0xFFFD; // Lone low surrogate
+            }
+            append_utf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+        run = i;
+    }
+    out.append(s.data() + run, s.size() - run);
+    return true;
+}
+} // namespace candidate_window
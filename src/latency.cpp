@@ -0,0 +1,101 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+namespace candidate_window {
+static uint64_t to_ns(latency_clock::duration d) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    size_t bucket = std::min<size_t>(std::bit_width(ns), kBuckets - 1);
+    ++buckets_[bucket];
+    ++count_;
+    sum_ns_ += ns;
+    max_ns_ = std::max(max_ns_, ns);
+}
+
+uint64_t LatencyHistogram::quantile_ns(double q) const {
+    if (!count_) {
+        return 0;
+    }
+    auto rank = static_cast<uint64_t>(q * (count_ - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            return std::min(i ? (uint64_t(1) << i) - 1 : 0, max_ns_);
+        }
+    }
+    return max_ns_;
+}
+
+void LatencyStats::record(
+    const char *stage,
+    std::map<std::string, LatencyHistogram, std::less<>> &by_name,
+    std::string_view name, uint32_t epoch, latency_clock::time_point start,
+    latency_clock::time_point end) {
+    auto iter = by_name.find(name);
+    if (iter == by_name.end()) {
+        iter = by_name.emplace(std::string(name), LatencyHistogram{}).first;
+    }
+    uint64_t ns = to_ns(end - start);
+    iter->second.record(ns);
+    // Map keys are stable, so events can point to them.
+    add_event(stage, iter->first.c_str(), epoch, start, ns);
+}
+
+void LatencyStats::record_show_to_resize(uint32_t epoch,
+                                         latency_clock::time_point start,
+                                         latency_clock::time_point end) {
+    uint64_t ns = to_ns(end - start);
+    if (!show_to_resize.count()) {
+        first_show_ns = ns;
+    }
+    show_to_resize.record(ns);
+    add_event("show_to_resize", "", epoch, start, ns);
+}
+
+void LatencyStats::record_load(latency_clock::time_point start,
+                               latency_clock::time_point end) {
+    load_ns = to_ns(end - start);
+    add_event("load", "", 0, start, load_ns);
+}
+
+void LatencyStats::record_prewarm(double ms) {
+    prewarm_ns = static_cast<uint64_t>(ms * 1e6);
+    add_event("prewarm", "", 0,
+              latency_clock::now() - std::chrono::nanoseconds(prewarm_ns),
+              prewarm_ns);
+}
+
+void LatencyStats::add_event(const char *stage, const char *name,
+                             uint32_t epoch, latency_clock::time_point start,
+                             uint64_t duration_ns) {
+    recent[events % kRecentEvents] = {stage, name, epoch,
+                                      to_ns(start.time_since_epoch()),
+                                      duration_ns};
+    ++events;
+}
+
+void js_serializer<LatencyStats>::write(std::string &out,
+                                        const LatencyStats &s) {
+    js_object_writer o(out);
+    o.field("invokeJs", s.invoke_js);
+    o.field("handlers", s.handlers);
+    o.field("showToResize", s.show_to_resize);
+    o.field("staleResizes", s.stale_resizes);
+    o.field("loadNs", s.load_ns);
+    o.field("firstShowNs", s.first_show_ns);
+    o.field("prewarmNs", s.prewarm_ns);
+    // Oldest first.
+    std::vector<LatencyEvent> recent;
+    uint64_t n = std::min<uint64_t>(s.events, LatencyStats::kRecentEvents);
+    for (uint64_t i = s.events - n; i < s.events; ++i) {
+        recent.push_back(s.recent[i % LatencyStats::kRecentEvents]);
+    }
+    o.field("recent", recent);
+}
+} // namespace candidate_window
@@ -0,0 +1,86 @@
+#include "page_assets.hpp"
+#include "page_assets_data.hpp"
+#include <utility>
+#include <zlib.h>
+
+std::optional<std::string> page_asset(std::string_view path) {
+    for (const auto &asset : PAGE_ASSETS) {
+        if (path != asset.path) {
+            continue;
+        }
+        z_stream stream{};
+        // 16 for the gzip header.
+        if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+            return std::nullopt;
+        }
+        stream.next_in = const_cast<Bytef *>(asset.gzipped);
+        stream.avail_in = asset.size;
+        std::string out;
+        int ret = Z_OK;
+        while (ret == Z_OK) {
+            // Text compresses several times, so grow by more than the input.
+            size_t offset = out.size();
+            out.resize(offset + 4 * asset.size + 4096);
+            stream.next_out = reinterpret_cast<Bytef *>(out.data() + offset);
+            stream.avail_out = static_cast<uInt>(out.size() - offset);
+            ret = inflate(&stream, Z_NO_FLUSH);
+            out.resize(out.size() - stream.avail_out);
+        }
+        inflateEnd(&stream);
+        if (ret != Z_STREAM_END) {
+            return std::nullopt;
+        }
+        return out;
+    }
+    return std::nullopt;
+}
+
+std::string inline_page() {
+    std::string html = page_asset("index.html").value_or("");
+    constexpr std::string_view src = " src=\"";
+    size_t pos = 0;
+    while ((pos = html.find("<script", pos)) != std::string::npos) {
+        size_t tag_end = html.find('>', pos);
+        size_t src_start = html.find(src, pos);
+        if (tag_end == std::string::npos || src_start > tag_end) {
+            pos = tag_end;
+            continue;
+        }
+        size_t name_start = src_start + src.size();
+        size_t name_end = html.find('"', name_start);
+        auto script =
+            page_asset(html.substr(name_start, name_end - name_start));
+        if (!script) {
+            pos = tag_end;
+            continue;
+        }
+        size_t close = html.find("</script>", tag_end);
+        size_t removed = name_end + 1 - src_start;
+        html.erase(src_start, removed);
+        tag_end -= removed;
+        close -= removed;
+        // A script can't contain its end tag, which parcel escaped when it
+        // inlined the script in the first place.
+        html.replace(tag_end + 1, close - tag_end - 1, *script);
+        // Skip the script, which may mention "<script" itself.
+        pos = tag_end + 1 + script->size();
+    }
+    return html;
+}
+
+const char *mime_type(std::string_view path) {
+    static constexpr std::pair<std::string_view, const char *> types[] = {
+        {".html", "text/html"},    {".js", "text/javascript"},
+        {".css", "text/css"},      {".json", "application/json"},
+        {".svg", "image/svg+xml"}, {".png", "image/png"},
+        {".jpg", "image/jpeg"},    {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},     {".webp", "image/webp"},
+        {".woff2", "font/woff2"},  {".woff", "font/woff"},
+        {".ttf", "font/ttf"},      {".otf", "font/otf"}};
+    for (const auto &[extension, type] : types) {
+        if (path.ends_with(extension)) {
+            return type;
+        }
+    }
+    return "application/octet-stream";
+}
@@ -1,27 +1,46 @@
 #include "webview_candidate_window.hpp"
 
 namespace candidate_window {
+// A page has one panel.
+static WebviewCandidateWindow *page_window = nullptr;
+
 extern "C" {
 EMSCRIPTEN_KEEPALIVE const char *web_action(const char *s) {
     static std::string ret;
-    ret = call_handler(s);
+    ret = page_window ? page_window->call_from_page(s) : "";
     return ret.c_str();
 }
 }
 
-void WebviewCandidateWindow::platform_init() {}
+void WebviewCandidateWindow::platform_init() { page_window = this; }
+
+void WebviewCandidateWindow::load_page() {}
 
-WebviewCandidateWindow::~WebviewCandidateWindow() {}
+WebviewCandidateWindow::~WebviewCandidateWindow() {
+    if (page_window == this) {
+        page_window = nullptr;
+    }
+}
 
 void WebviewCandidateWindow::set_transparent_background() {}
 
 void WebviewCandidateWindow::update_accent_color() {}
 
 void WebviewCandidateWindow::hide() const {
+    trace_.write(TraceKind::hide);
     EM_ASM(fcitx.hidePanel());
     epoch += 1;
+    invalidate_frame();
 }
 
+MemoryUsage WebviewCandidateWindow::memory_usage() const { return {}; }
+
+void WebviewCandidateWindow::apply_memory_policy() {}
+
+void WebviewCandidateWindow::watch_memory() const {}
+
+void WebviewCandidateWindow::release_webkit_memory() const {}
+
 void WebviewCandidateWindow::write_clipboard(const std::string &html) {}
 
 void WebviewCandidateWindow::resize(
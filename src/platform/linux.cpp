@@ -1,10 +1,181 @@
+#include "page_assets.hpp"
 #include "webview_candidate_window.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <gtk/gtk.h>
+#include <iterator>
+#include <limits>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <webkit2/webkit2.h>
 
 namespace candidate_window {
+// Horizontal inset of a corner with radius at the given row (0 is the edge).
+static int corner_inset(int radius, int row) {
+    if (row >= radius) {
+        return 0;
+    }
+    double dy = radius - row - 0.5;
+    return radius - (int)std::lround(std::sqrt(radius * radius - dy * dy));
+}
+
+// Cairo regions are made of rectangles, so approximate the rounded corners
+// with rectangles of rows that share the same insets.
+static cairo_region_t *rounded_rect_region(const std::array<int, 8> &shape) {
+    auto [top, right, bottom, left, top_left, top_right, bottom_right,
+          bottom_left] = shape;
+    cairo_region_t *region = cairo_region_create();
+    int width = right - left;
+    int height = bottom - top;
+    if (width <= 0 || height <= 0) {
+        return region;
+    }
+    int max_radius = std::min(width, height) / 2;
+    auto clamp = [&](int radius) { return std::clamp(radius, 0, max_radius); };
+    top_left = clamp(top_left);
+    top_right = clamp(top_right);
+    bottom_right = clamp(bottom_right);
+    bottom_left = clamp(bottom_left);
+    int run_start = 0;
+    int run_left = -1;
+    int run_right = -1;
+    for (int row = 0; row <= height; ++row) {
+        int l = -1;
+        int r = -1;
+        if (row < height) {
+            int from_bottom = height - 1 - row;
+            l = std::max(corner_inset(top_left, row),
+                         corner_inset(bottom_left, from_bottom));
+            r = std::max(corner_inset(top_right, row),
+                         corner_inset(bottom_right, from_bottom));
+        }
+        if (l != run_left || r != run_right) {
+            if (row > run_start) {
+                cairo_rectangle_int_t rect{left + run_left, top + run_start,
+                                           width - run_left - run_right,
+                                           row - run_start};
+                cairo_region_union_rectangle(region, &rect);
+            }
+            run_start = row;
+            run_left = l;
+            run_right = r;
+        }
+    }
+    return region;
+}
+
+#ifdef WKWEBVIEW_PROTOCOL
+static constexpr const char *kScheme = WKWEBVIEW_PROTOCOL;
+#else
+static constexpr const char *kScheme = "fcitx";
+#endif
+
+#ifdef WEBVIEW_WWW_PATH
+// Same as macOS: fcitx:///file/foo/bar is ~/WEBVIEW_WWW_PATH/foo/bar.
+static std::optional<std::string> read_www_file(std::string_view path) {
+    namespace fs = std::filesystem;
+    const char *home = getenv("HOME");
+    if (!home) {
+        return std::nullopt;
+    }
+    std::error_code ec;
+    auto base = fs::weakly_canonical(fs::path(home) / WEBVIEW_WWW_PATH, ec);
+    auto file = fs::weakly_canonical(base / fs::path(path).relative_path(), ec);
+    auto [end, _] = std::mismatch(base.begin(), base.end(), file.begin(),
+                                  file.end());
+    if (ec || end != base.end()) {
+        return std::nullopt;
+    }
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+#endif
+
+// fcitx:///page/<file> is the page embedded in the binary.
+static void serve_scheme(WebKitURISchemeRequest *request, gpointer) {
+    std::string_view path = webkit_uri_scheme_request_get_path(request);
+    std::optional<std::string> data;
+    bool page = path.starts_with("/page/");
+    if (page) {
+        data = page_asset(path.substr(6));
+    }
+#ifdef WEBVIEW_WWW_PATH
+    if (path.starts_with("/file/")) {
+        data = read_www_file(path.substr(6));
+    }
+#endif
+    if (!data) {
+        GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                    "%s not found", path.data());
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+        return;
+    }
+    auto size = static_cast<gint64>(data->size());
+    auto owned = new std::string(std::move(*data));
+    GBytes *bytes = g_bytes_new_with_free_func(
+        owned->data(), owned->size(),
+        [](gpointer p) { delete static_cast<std::string *>(p); }, owned);
+    GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+    g_bytes_unref(bytes);
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+    auto response = webkit_uri_scheme_response_new(stream, size);
+    webkit_uri_scheme_response_set_content_type(response, mime_type(path));
+    if (page) {
+        auto headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+        // Other files are named by hash of their content.
+        soup_message_headers_append(headers, "Cache-Control",
+                                    path == "/page/index.html"
+                                        ? "no-cache"
+                                        : "max-age=31536000, immutable");
+        webkit_uri_scheme_response_set_http_headers(response, headers);
+    }
+    webkit_uri_scheme_request_finish_with_response(request, response);
+    g_object_unref(response);
+#else
+    webkit_uri_scheme_request_finish(request, stream, size, mime_type(path));
+#endif
+    g_object_unref(stream);
+}
 
 void WebviewCandidateWindow::platform_init() {}
 
+void WebviewCandidateWindow::load_page() {
+    auto webview = static_cast<WebKitWebView *>(w_->browser_controller());
+    if (!webview) {
+        w_->set_html(inline_page());
+        return;
+    }
+    // Unlike a string of HTML, files at stable URLs can be cached by WebKit.
+    auto context = webkit_web_view_get_context(webview);
+    if (!g_object_get_data(G_OBJECT(context), kScheme)) {
+        webkit_web_context_register_uri_scheme(context, kScheme, serve_scheme,
+                                               nullptr, nullptr);
+        auto security = webkit_web_context_get_security_manager(context);
+        webkit_security_manager_register_uri_scheme_as_secure(security,
+                                                              kScheme);
+        // Modules are fetched with CORS, even from the page's own origin.
+        webkit_security_manager_register_uri_scheme_as_cors_enabled(security,
+                                                                    kScheme);
+        g_object_set_data(G_OBJECT(context), kScheme, GINT_TO_POINTER(1));
+    }
+    webkit_web_view_load_uri(webview,
+                             (std::string(kScheme) + ":///page/index.html")
+                                 .c_str());
+}
+
 void *WebviewCandidateWindow::create_window() {
     gtk_init(nullptr, nullptr);
     auto window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -14,7 +185,12 @@ void *WebviewCandidateWindow::create_window() {
 }
 
 WebviewCandidateWindow::~WebviewCandidateWindow() {
-    gtk_widget_destroy(unwrap_webview_handle<GtkWidget>(w_->window()));
+    if (idle_release_source_) {
+        g_source_remove(idle_release_source_);
+    }
+    if (native_) {
+        gtk_widget_destroy(unwrap_webview_handle<GtkWidget>(w_->window()));
+    }
 }
 
 void WebviewCandidateWindow::set_transparent_background() {
@@ -37,7 +213,139 @@ void WebviewCandidateWindow::set_transparent_background() {
 
 void WebviewCandidateWindow::update_accent_color() {}
 
-void WebviewCandidateWindow::hide() const { epoch += 1; }
+void WebviewCandidateWindow::hide() const {
+    trace_.write(TraceKind::hide);
+    if (native_) {
+        gtk_widget_hide(unwrap_webview_handle<GtkWidget>(w_->window()));
+    }
+    hidden_ = true;
+    epoch += 1;
+    watch_memory();
+}
+
+// Resident memory in bytes of a process.
+static size_t resident_bytes(pid_t pid) {
+    std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// WebKit's web, network and GPU processes started by pid, directly or by a
+// bubblewrap sandbox. Other children of the process are not counted.
+static std::vector<pid_t> webkit_processes(pid_t pid) {
+    std::unordered_multimap<pid_t, pid_t> children;
+    std::unordered_set<pid_t> webkit;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator("/proc", ec)) {
+        pid_t child = std::atoi(entry.path().filename().c_str());
+        if (child <= 0) {
+            continue;
+        }
+        std::ifstream stat(entry.path() / "stat");
+        std::string line;
+        if (!std::getline(stat, line)) {
+            continue;
+        }
+        // pid (comm) state ppid ..., where comm is the executable name cut
+        // to 15 characters, e.g. WebKitWebProces.
+        auto open = line.find('(');
+        auto close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos) {
+            continue;
+        }
+        if (line.compare(open + 1, 6, "WebKit") == 0) {
+            webkit.insert(child);
+        }
+        std::istringstream fields(line.substr(close + 1));
+        std::string state;
+        pid_t ppid = 0;
+        fields >> state >> ppid;
+        children.emplace(ppid, child);
+    }
+    std::vector<pid_t> descendants{pid};
+    for (size_t i = 0; i < descendants.size(); ++i) {
+        auto [begin, end] = children.equal_range(descendants[i]);
+        for (auto iter = begin; iter != end; ++iter) {
+            descendants.push_back(iter->second);
+        }
+    }
+    std::vector<pid_t> result;
+    std::copy_if(descendants.begin() + 1, descendants.end(),
+                 std::back_inserter(result),
+                 [&](pid_t p) { return webkit.contains(p); });
+    return result;
+}
+
+MemoryUsage WebviewCandidateWindow::memory_usage() const {
+    MemoryUsage usage;
+    usage.ui_process = resident_bytes(getpid());
+    for (pid_t pid : webkit_processes(getpid())) {
+        usage.web_processes += resident_bytes(pid);
+    }
+    return usage;
+}
+
+void WebviewCandidateWindow::apply_memory_policy() {
+    bool enabled =
+        memory_policy_.idle_release.count() || memory_policy_.soft_budget;
+    if (auto webview = static_cast<WebKitWebView *>(w_->browser_controller())) {
+        // The page is one document whose few resources are local, so it needs
+        // neither page cache nor much of memory caches.
+        webkit_web_context_set_cache_model(
+            webkit_web_view_get_context(webview),
+            enabled ? WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER
+                    : WEBKIT_CACHE_MODEL_WEB_BROWSER);
+    }
+    if (!memory_policy_.idle_release.count() && idle_release_source_) {
+        g_source_remove(idle_release_source_);
+        idle_release_source_ = 0;
+    }
+}
+
+// Reading /proc of all processes takes a while, unlike hide().
+static constexpr auto kBudgetCheckInterval = std::chrono::seconds(5);
+
+void WebviewCandidateWindow::watch_memory() const {
+    if (idle_release_source_) {
+        g_source_remove(idle_release_source_);
+        idle_release_source_ = 0;
+    }
+    if (memory_policy_.idle_release.count()) {
+        idle_release_source_ = g_timeout_add(
+            memory_policy_.idle_release.count(),
+            [](gpointer data) -> gboolean {
+                auto self = static_cast<WebviewCandidateWindow *>(data);
+                self->idle_release_source_ = 0;
+                self->release_memory();
+                return G_SOURCE_REMOVE;
+            },
+            const_cast<WebviewCandidateWindow *>(this));
+    }
+    auto now = latency_clock::now();
+    if (memory_policy_.soft_budget &&
+        now - budget_checked_ >= kBudgetCheckInterval) {
+        budget_checked_ = now;
+        auto usage = memory_usage();
+        if (usage.ui_process + usage.web_processes >
+            memory_policy_.soft_budget) {
+            release_memory();
+        }
+    }
+}
+
+void WebviewCandidateWindow::release_webkit_memory() const {
+    if (auto webview = static_cast<WebKitWebView *>(w_->browser_controller())) {
+        auto context = webkit_web_view_get_context(webview);
+        webkit_web_context_clear_cache(context);
+        webkit_web_context_garbage_collect_javascript_objects(context);
+    }
+#ifdef __GLIBC__
+    // Return what the released state took to the system.
+    malloc_trim(0);
+#endif
+}
 
 void WebviewCandidateWindow::write_clipboard(const std::string &html) {}
 
@@ -48,7 +356,94 @@ void WebviewCandidateWindow::resize(
     double top_left_radius, double top_right_radius, double bottom_right_radius,
     double bottom_left_radius, double border_width, double width, double height,
     bool dragging) {
-    gtk_widget_show_all(unwrap_webview_handle<GtkWidget>(w_->window()));
+    const int gap = 4;
+    auto window = unwrap_webview_handle<GtkWidget>(w_->window());
+    auto display = gtk_widget_get_display(window);
+    GdkMonitor *monitor =
+        gdk_display_get_monitor_at_point(display, caret_x_, caret_y_);
+    // None while monitors are hot-plugged, and on some Wayland sessions.
+    if (!monitor) {
+        monitor = gdk_display_get_primary_monitor(display);
+    }
+    // Without any, the window is placed at the caret unclamped.
+    double left = -std::numeric_limits<double>::infinity();
+    double right = std::numeric_limits<double>::infinity();
+    double top = left;
+    double bottom = right;
+    if (monitor) {
+        GdkRectangle frame;
+        gdk_monitor_get_workarea(monitor, &frame);
+        left = frame.x;
+        right = frame.x + frame.width;
+        top = frame.y;
+        bottom = frame.y + frame.height;
+    }
+    // Yes, there is no guarantee that caret is within the screen.
+    double adjusted_x = std::min(std::max(caret_x_, left), right);
+    double adjusted_y = std::min(std::max(caret_y_, top), bottom);
+
+    if (dragging) {
+        x_ += dx;
+        y_ += dy;
+    } else {
+        if (panel_state().layout == layout_t::vertical &&
+            panel_state().writing_mode == writing_mode_t::vertical_rl) {
+            // Right side of the window needs to align with the caret as
+            // the first candidate is on the right.
+            x_ = adjusted_x - anchor_right;
+            x_ = std::max<double>(x_, left - anchor_left);
+            x_ = std::min<double>(x_, right - anchor_right);
+        } else {
+            x_ = adjusted_x - anchor_left;
+            x_ = std::min<double>(x_, right - anchor_right);
+            x_ = std::max<double>(x_, left - anchor_left);
+        }
+        // X11 has top-left (0, 0), and caret_y_ is the top of caret.
+        double caret_bottom = adjusted_y + caret_height_;
+        if (caret_bottom + gap + anchor_bottom - anchor_top >
+                bottom                     // No enough space underneath
+            || (!hidden_ && was_above_)) { // It was above, avoid flicker
+            y_ = std::min<double>(adjusted_y - gap, bottom) - anchor_bottom;
+            y_ = std::max<double>(y_, top - anchor_top);
+            was_above_ = true;
+        } else {
+            y_ = caret_bottom + gap - anchor_top;
+            was_above_ = false;
+        }
+    }
+    hidden_ = false;
+
+    // Every move, resize or shape is a round trip with the window manager,
+    // so only request what changed.
+    std::array<int, 4> new_frame{(int)std::lround(x_), (int)std::lround(y_),
+                                 (int)std::ceil(width), (int)std::ceil(height)};
+    if (!applied_frame_ || (*applied_frame_)[0] != new_frame[0] ||
+        (*applied_frame_)[1] != new_frame[1]) {
+        gtk_window_move(GTK_WINDOW(window), new_frame[0], new_frame[1]);
+    }
+    if (!applied_frame_ || (*applied_frame_)[2] != new_frame[2] ||
+        (*applied_frame_)[3] != new_frame[3]) {
+        gtk_window_resize(GTK_WINDOW(window), new_frame[2], new_frame[3]);
+    }
+    applied_frame_ = new_frame;
+
+    // Only the panel takes input, and its shadow is click-through.
+    std::array<int, 8> shape{
+        (int)std::floor(panel_top),         (int)std::ceil(panel_right),
+        (int)std::ceil(panel_bottom),       (int)std::floor(panel_left),
+        (int)std::lround(top_left_radius),  (int)std::lround(top_right_radius),
+        (int)std::lround(bottom_right_radius),
+        (int)std::lround(bottom_left_radius)};
+    if (applied_shape_ != shape) {
+        cairo_region_t *region = rounded_rect_region(shape);
+        gtk_widget_input_shape_combine_region(window, region);
+        cairo_region_destroy(region);
+        applied_shape_ = shape;
+    }
+
+    if (!gtk_widget_get_visible(window)) {
+        gtk_widget_show_all(window);
+    }
 }
 
 void WebviewCandidateWindow::set_native_blur(blur_t value) const {}
@@ -1,7 +1,9 @@
+#include "page_assets.hpp"
 #include "webview_candidate_window.hpp"
 #include <QuartzCore/QuartzCore.h>
 #include <UniformTypeIdentifiers/UniformTypeIdentifiers.h>
 #include <WebKit/WKWebView.h>
+#include <mach/mach.h>
 
 NSString *const F5mErrorDomain = @"F5mErrorDomain";
 
@@ -226,6 +228,9 @@ void WebviewCandidateWindow::platform_init() {
     version_ = version.majorVersion;
 }
 
+// FileSchemeHandler only serves user files, so the page goes as a string.
+void WebviewCandidateWindow::load_page() { w_->set_html(inline_page()); }
+
 void *WebviewCandidateWindow::create_window() {
     auto window =
         [[HoverableWindow alloc] initWithContentRect:NSMakeRect(0, 0, 400, 300)
@@ -313,23 +318,45 @@ void WebviewCandidateWindow::set_transparent_background() {
 void WebviewCandidateWindow::update_accent_color() {
     NSNumber *accentColor = [[NSUserDefaults standardUserDefaults]
         objectForKey:@"AppleAccentColor"];
-    if (accentColor == nil) {
-        accent_color_nil_ = true;
-    } else {
-        accent_color_nil_ = false;
-        accent_color_ = [accentColor intValue];
+    bool nil = accentColor == nil;
+    int value = nil ? accent_color_ : [accentColor intValue];
+    if (nil != accent_color_nil_ || value != accent_color_) {
+        accent_color_nil_ = nil;
+        accent_color_ = value;
+        ++accent_color_generation_;
     }
 }
 
 void WebviewCandidateWindow::hide() const {
+    trace_.write(TraceKind::hide);
     auto window = unwrap_webview_handle<NSWindow>(w_->window());
     [window orderBack:nil];
     [window setIsVisible:NO];
     hidden_ = true;
     epoch += 1;
+    invalidate_frame();
     invoke_js("hidePanel");
 }
 
+// Web content processes are not children of this one, so not counted.
+MemoryUsage WebviewCandidateWindow::memory_usage() const {
+    MemoryUsage usage;
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info),
+                  &count) == KERN_SUCCESS) {
+        usage.ui_process = info.resident_size;
+    }
+    return usage;
+}
+
+void WebviewCandidateWindow::apply_memory_policy() {}
+
+void WebviewCandidateWindow::watch_memory() const {}
+
+void WebviewCandidateWindow::release_webkit_memory() const {}
+
 void WebviewCandidateWindow::write_clipboard(const std::string &html) {
     NSString *s = [NSString stringWithUTF8String:html.c_str()];
     NSPasteboard *pasteboard = [NSPasteboard generalPasteboard];
@@ -358,8 +385,8 @@ void WebviewCandidateWindow::resize(
         x_ += dx;
         y_ -= dy; // minus because macOS has bottom-left (0, 0)
     } else {
-        if (layout_ == layout_t::vertical &&
-            writing_mode_ == writing_mode_t::vertical_rl) {
+        if (panel_state().layout == layout_t::vertical &&
+            panel_state().writing_mode == writing_mode_t::vertical_rl) {
             // Right side of the window needs to align with the caret as
             // the first candidate is on the right.
             x_ = adjusted_x - anchor_right;
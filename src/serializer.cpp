@@ -0,0 +1,100 @@
+#include "serializer.hpp"
+
+namespace candidate_window {
+// Length of the valid UTF-8 sequence at s[i], or 0 if it's invalid.
+static std::size_t utf8_sequence_length(std::string_view s, std::size_t i) {
+    auto byte = [&](std::size_t k) -> unsigned char {
+        return i + k < s.size() ? s[i + k] : 0;
+    };
+    auto continuation = [&](std::size_t k) {
+        return (byte(k) & 0xC0) == 0x80;
+    };
+    unsigned char c = byte(0);
+    if (c >= 0xC2 && c <= 0xDF) {
+        return continuation(1) ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        unsigned char lo = c == 0xE0 ? 0xA0 : 0x80; // Overlong
+        unsigned char hi = c == 0xED ? 0x9F : 0xBF; // Surrogates
+        return byte(1) >= lo && byte(1) <= hi && continuation(2) ? 3 : 0;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        unsigned char lo = c == 0xF0 ? 0x90 : 0x80; // Overlong
+        unsigned char hi = c == 0xF4 ? 0x8F : 0xBF; // Above U+10FFFF
+        return byte(1) >= lo && byte(1) <= hi && continuation(2) &&
+                       continuation(3)
+                   ? 4
+                   : 0;
+    }
+    return 0;
+}
+
+void write_js_string(std::string &out, std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    out.reserve(out.size() + s.size() + 2);
+    out += '"';
+    // Bytes in [run, i) need no escaping and are appended in bulk.
+    std::size_t run = 0;
+    std::size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+        std::size_t length = 1;
+        const char *escaped = nullptr;
+        if (c >= 0x80) {
+            length = utf8_sequence_length(s, i);
+            if (length == 3 && c == 0xE2 && (unsigned char)s[i + 1] == 0x80 &&
+                ((unsigned char)s[i + 2] & 0xFE) == 0xA8) {
+                // Line terminators in JS string literals before ES2019.
+                escaped = (unsigned char)s[i + 2] == 0xA8 ? "\\u2028"
+                                                          : "\\u2029";
+            } else if (length) {
+                i += length;
+                continue;
+            } else {
+                length = 1;
+                escaped = "\\ufffd";
+            }
+        }
+        out.append(s.data() + run, i - run);
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\b':
+            out += "\\b";
+            break;
+        case '\f':
+            out += "\\f";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (escaped) {
+                out += escaped;
+            } else {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            }
+        }
+        i += length;
+        run = i;
+    }
+    out.append(s.data() + run, s.size() - run);
+    out += '"';
+}
+} // namespace candidate_window
@@ -0,0 +1,55 @@
+#include "trace.hpp"
+#include <sstream>
+
+namespace candidate_window {
+bool TraceWriter::open(const std::string &path) {
+    close();
+    std::lock_guard g(mutex_);
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        file_ = {};
+        return false;
+    }
+    buffer_ = kTraceMagic;
+    buffer_ += static_cast<char>(kTraceVersion);
+    last_ = latency_clock::now();
+    open_ = true;
+    return true;
+}
+
+void TraceWriter::close() {
+    std::lock_guard g(mutex_);
+    open_ = false;
+    if (file_.is_open()) {
+        flush();
+        file_.close();
+    }
+}
+
+void TraceWriter::flush() {
+    file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    file_.flush();
+    buffer_.clear();
+}
+
+bool TraceReader::open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    data_ = ss.str();
+    in_ = data_;
+    if (!in_.starts_with(kTraceMagic) || in_.size() <= kTraceMagic.size() ||
+        static_cast<uint8_t>(in_[kTraceMagic.size()]) != kTraceVersion) {
+        return false;
+    }
+    in_.remove_prefix(kTraceMagic.size() + 1);
+    return true;
+}
+
+bool TraceReader::next(uint64_t &delay_us, TraceKind &kind) {
+    return read(delay_us) && read(kind) && kind <= TraceKind::js_call;
+}
+} // namespace candidate_window
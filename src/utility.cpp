@@ -1,24 +1,23 @@
 #include "utility.hpp"
+#include "base64.hpp"
 #include <sstream>
 
 std::string base64(const std::string &s) {
-    static const char *chars =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     std::string ret;
-    ret.reserve((s.size() + 2) / 3 * 4);
-    unsigned int w = 0;
-    int b = -6;
-    for (unsigned char c : s) {
-        w = (w << 8) + c;
-        b += 8;
-        while (b >= 0) {
-            ret += chars[(w >> b) & 0x3F];
-            b -= 6;
+    base64_encode(s, ret);
+    return ret;
+}
+
+size_t utf8_complete_length(std::string_view s) {
+    // A sequence is at most 4 bytes, so only look at the last 3.
+    size_t n = s.size();
+    for (size_t i = 1; i <= 3 && i <= n; ++i) {
+        unsigned char c = s[n - i];
+        if ((c & 0xC0) == 0x80) {
+            continue; // Continuation byte.
         }
+        size_t length = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+        return length > i ? n - i : n;
     }
-    if (b > -6)
-        ret += chars[((w << 8) >> (b + 8)) & 0x3F];
-    while (ret.size() % 4)
-        ret += '=';
-    return ret;
+    return n;
 }
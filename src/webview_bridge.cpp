@@ -0,0 +1,53 @@
+#include "bridge.hpp"
+#include "webview.h"
+
+namespace candidate_window {
+class WebviewBridge : public Bridge {
+  public:
+    explicit WebviewBridge(void *window) : w_(true, window) {}
+
+    void eval(const std::string &js) override { w_.eval(js); }
+    void set_html(const std::string &html) override { w_.set_html(html); }
+    void bind(const std::string &name, handler_t handler) override {
+        w_.bind(name, [handler = std::move(handler)](std::string args) {
+            return handler(args);
+        });
+    }
+    void bind_async(const std::string &name,
+                    async_handler_t handler) override {
+        w_.bind(
+            name,
+            [handler = std::move(handler)](std::string id, std::string args,
+                                           void *) {
+                handler(std::move(id), std::move(args));
+            },
+            nullptr);
+    }
+    void unbind(const std::string &name) override { w_.unbind(name); }
+    void resolve(const std::string &id, int status,
+                 const std::string &result) override {
+        w_.resolve(id, status, result);
+    }
+    void dispatch(std::function<void()> f) override {
+        w_.dispatch(std::move(f));
+    }
+
+    void *window() override { return unwrap(w_.window()); }
+    void *widget() override { return unwrap(w_.widget()); }
+    void *browser_controller() override {
+        return unwrap(w_.browser_controller());
+    }
+
+  private:
+    static void *unwrap(webview::result<void *> handle) {
+        handle.ensure_ok();
+        return handle.value();
+    }
+
+    webview::webview w_;
+};
+
+std::unique_ptr<Bridge> make_webview_bridge(void *window) {
+    return std::make_unique<WebviewBridge>(window);
+}
+} // namespace candidate_window
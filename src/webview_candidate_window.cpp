@@ -1,32 +1,74 @@
 #include "webview_candidate_window.hpp"
 #ifndef __EMSCRIPTEN__
+#include "base64.hpp"
 #include "curl.hpp"
-#include "html_template.hpp"
+#include "curl_cache.hpp"
 #endif
 #include "utility.hpp"
 #include <algorithm>
 #include <iostream>
-#include <sstream>
+#include <mutex>
+#include <string_view>
 
 namespace candidate_window {
-std::unordered_map<std::string,
-                   std::function<std::string(const nlohmann::json &)>>
-    handlers;
+uint16_t HandlerRegistry::add(const std::string &name, handler_t handler) {
+    auto [iter, inserted] =
+        opcodes_.emplace(name, static_cast<uint16_t>(handlers_.size()));
+    if (inserted) {
+        handlers_.push_back(std::move(handler));
+    } else {
+        handlers_[iter->second] = std::move(handler);
+    }
+    return iter->second;
+}
+
+void HandlerRegistry::remove(std::string_view name) {
+    if (auto iter = opcodes_.find(name); iter != opcodes_.end()) {
+        handlers_[iter->second] = nullptr;
+    }
+}
 
-std::string call_handler(std::string s) {
-    auto args = nlohmann::json::parse(s);
-    if (!args.is_array() || args.empty()) {
+std::string HandlerRegistry::dispatch(std::string_view s,
+                                      std::vector<std::string_view> &args) {
+    if (!split_js_array(s, args) || args.empty()) {
         std::cerr << "[JS] Invalid call to fcitx: " << s << "\n";
         return "";
     }
-    std::string name = args[0].get<std::string>();
-    auto iter = handlers.find(name);
-    if (iter == handlers.end()) {
-        std::cerr << "[JS] Unknown handler name '" << name << "'\n";
+    uint16_t opcode;
+    if (!read_js(args[0], opcode)) {
+        // Name is an ASCII identifier, so the quoted slice needs no
+        // unescaping.
+        auto name = args[0];
+        if (name.size() < 2 || name.front() != '"' || name.back() != '"') {
+            std::cerr << "[JS] Invalid call to fcitx: " << s << "\n";
+            return "";
+        }
+        name = name.substr(1, name.size() - 2);
+        auto iter = opcodes_.find(name);
+        if (iter == opcodes_.end()) {
+            std::cerr << "[JS] Unknown handler name '" << name << "'\n";
+            return "";
+        }
+        opcode = iter->second;
+    } else if (opcode >= handlers_.size()) {
+        std::cerr << "[JS] Unknown handler opcode " << opcode << "\n";
         return "";
     }
-    args.erase(args.begin());
-    return iter->second(args);
+    if (!handlers_[opcode]) {
+        std::cerr << "[JS] Removed handler " << args[0] << "\n";
+        return "";
+    }
+    return handlers_[opcode](std::span(args).subspan(1));
+}
+
+std::string HandlerRegistry::call(std::string_view s) {
+    // Swap the buffer out so that a handler calling back into JS that calls
+    // fcitx again is safe.
+    std::vector<std::string_view> args;
+    args.swap(buffer_);
+    auto ret = dispatch(s, args);
+    buffer_.swap(args);
+    return ret;
 }
 
 void to_json(nlohmann::json &j, const CandidateAction &a) {
@@ -41,16 +83,86 @@ void to_json(nlohmann::json &j, const Candidate &c) {
                        {"spaceBetweenComment", c.spaceBetweenComment}};
 }
 
+// Replace delete_count candidates at start with [begin, end), like JS
+// Array.prototype.splice.
+struct CandidateSplice {
+    size_t start;
+    size_t delete_count;
+    const Candidate *begin;
+    const Candidate *end;
+};
+
+template <> struct js_serializer<CandidateSplice> {
+    static void write(std::string &out, const CandidateSplice &s) {
+        out += '[';
+        write_js_args(out, s.start, s.delete_count);
+        out += ",[";
+        for (auto c = s.begin; c != s.end; ++c) {
+            if (c != s.begin) {
+                out += ',';
+            }
+            write_js(out, *c);
+        }
+        out += "]]";
+    }
+};
+
+// Splices to be applied in order that turn from into to. For lists of the same
+// length (e.g. highlight or comment change), each run of changed candidates is
+// replaced in place; otherwise common prefix and suffix are kept.
+static std::vector<CandidateSplice>
+diff_candidates(const std::vector<Candidate> &from,
+                const std::vector<Candidate> &to) {
+    std::vector<CandidateSplice> splices;
+    if (from.size() == to.size()) {
+        for (size_t i = 0; i < to.size();) {
+            if (from[i] == to[i]) {
+                ++i;
+                continue;
+            }
+            size_t j = i + 1;
+            while (j < to.size() && !(from[j] == to[j])) {
+                ++j;
+            }
+            splices.push_back({i, j - i, to.data() + i, to.data() + j});
+            i = j;
+        }
+        return splices;
+    }
+    size_t common = std::min(from.size(), to.size());
+    size_t prefix = 0;
+    while (prefix < common && from[prefix] == to[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < common - prefix &&
+           from[from.size() - 1 - suffix] == to[to.size() - 1 - suffix]) {
+        ++suffix;
+    }
+    splices.push_back({prefix, from.size() - prefix - suffix,
+                       to.data() + prefix, to.data() + to.size() - suffix});
+    return splices;
+}
+
+#ifndef __EMSCRIPTEN__
+WebviewCandidateWindow::WebviewCandidateWindow(
+    std::function<void()> init_callback)
+    : WebviewCandidateWindow(nullptr, std::move(init_callback)) {}
+
+WebviewCandidateWindow::WebviewCandidateWindow(
+    std::unique_ptr<Bridge> bridge, std::function<void()> init_callback)
+    : main_thread_id_(std::this_thread::get_id()), native_(!bridge),
+      w_(bridge ? std::move(bridge) : make_webview_bridge(create_window()))
+#else
 WebviewCandidateWindow::WebviewCandidateWindow(
     std::function<void()> init_callback)
-#ifndef __EMSCRIPTEN__
-    : main_thread_id_(std::this_thread::get_id()),
-      w_(std::make_unique<webview::webview>(1, create_window()))
 #endif
 {
-    platform_init();
-    set_transparent_background();
-    update_accent_color();
+    if (native_) {
+        platform_init();
+        set_transparent_background();
+        update_accent_color();
+    }
 
     bind("resize",
          [this](uint32_t result_epoch, double dx, double dy, double anchor_top,
@@ -64,8 +176,18 @@ WebviewCandidateWindow::WebviewCandidateWindow(
              // because JS code runs in another thread and can be slow
              // sometimes.
              // NOTE: accept result_epoch=0 because of wrapping.
-             if (result_epoch != 0 && result_epoch < epoch)
+             if (result_epoch != 0 && result_epoch < epoch) {
+                 latency_stats_.stale_resizes += 1;
+                 return;
+             }
+             if (result_epoch == epoch && measured_epoch_ != epoch) {
+                 measured_epoch_ = epoch;
+                 latency_stats_.record_show_to_resize(epoch, show_time_,
+                                                      latency_clock::now());
+             }
+             if (!native_) {
                  return;
+             }
              resize(dx, dy, anchor_top, anchor_right, anchor_bottom,
                     anchor_left, panel_top, panel_right, panel_bottom,
                     panel_left, top_left_radius, top_right_radius,
@@ -82,13 +204,44 @@ WebviewCandidateWindow::WebviewCandidateWindow(
     bind("scroll",
          [this](int start, int length) { scroll_callback(start, length); });
 
+    bind("scrollRange", [this](int session, int start, int length) {
+        size_t size = scroll_candidates_.size();
+        size_t begin = std::min<size_t>(std::max(start, 0), size);
+        size_t end = std::min<size_t>(begin + std::max(length, 0), size);
+        invoke_js("setScrollRange", session, begin,
+                  std::span<const Candidate>(scroll_candidates_.data() + begin,
+                                             end - begin));
+    });
+
     bind("askActions", [this](int i) { ask_actions_callback(i); });
 
     bind("action", [this](int i, int id) { action_callback(i, id); });
 
     bind("onload", [this, init_callback = std::move(init_callback)]() {
+        latency_stats_.record_load(create_time_, latency_clock::now());
+        loaded_ = true;
+        invalidate_frame();
+        sent_style_hash_.reset(); // A reloaded page has none.
         invoke_js("setHost", system_, version_);
         init_callback();
+        // After init_callback, so that its style is what gets warmed up.
+        if (prewarm_pending_) {
+            prewarm_pending_ = false;
+            invoke_js("prewarm", hidden_);
+        }
+    });
+
+    bind("prewarmed", [this](double ms, bool rendered) {
+        if (rendered) {
+            // The page no longer shows what was last sent.
+            invalidate_frame();
+            latency_stats_.record_prewarm(ms);
+        }
+        auto done = std::move(prewarm_done_);
+        prewarm_done_ = nullptr;
+        if (done) {
+            done();
+        }
     });
 
     bind("log", [](std::string s) { std::cerr << s; });
@@ -98,30 +251,35 @@ WebviewCandidateWindow::WebviewCandidateWindow(
 #ifdef __EMSCRIPTEN__
     EM_ASM(fcitx.createPanel());
 #else
-    std::string html_template(reinterpret_cast<char *>(HTML_TEMPLATE),
-                              HTML_TEMPLATE_len);
-    w_->bind("fcitx", call_handler);
-    w_->set_html(html_template.c_str());
+    w_->bind("fcitx", [this](std::string_view s) { return call_from_page(s); });
+    load_page();
 #endif
 }
 
 void WebviewCandidateWindow::apply_app_accent_color(
     const std::string &accent_color) {
-    app_accent_color_ = accent_color;
+    if (app_accent_color_ != accent_color) {
+        app_accent_color_ = accent_color;
+        ++accent_color_generation_;
+    }
     // Set immediately (usually on focus in) to avoid flicker.
     set_accent_color();
 }
 
-void WebviewCandidateWindow::set_accent_color() const {
+std::variant<std::nullptr_t, std::string_view, int>
+WebviewCandidateWindow::accent_color_value() const {
     if (accent_color_nil_) { // multi-color
         if (app_accent_color_.empty()) {
-            invoke_js("setAccentColor", nullptr);
-        } else {
-            invoke_js("setAccentColor", app_accent_color_);
+            return nullptr;
         }
-    } else {
-        invoke_js("setAccentColor", accent_color_);
+        return app_accent_color_;
     }
+    return accent_color_;
+}
+
+void WebviewCandidateWindow::set_accent_color() const {
+    invoke_js("setAccentColor", accent_color_value());
+    sent_accent_color_generation_ = accent_color_generation_;
 }
 
 void WebviewCandidateWindow::set_candidates(std::vector<Candidate> candidates,
@@ -129,15 +287,71 @@ void WebviewCandidateWindow::set_candidates(std::vector<Candidate> candidates,
                                             scroll_state_t scroll_state,
                                             bool scroll_start,
                                             bool scroll_end) {
-    candidates_ = std::move(candidates);
-    highlighted_ = highlighted;
-    scroll_state_ = scroll_state;
-    scroll_start_ = scroll_start;
-    scroll_end_ = scroll_end;
+    trace_.write(TraceKind::set_candidates, candidates, highlighted,
+                 scroll_state, scroll_start, scroll_end);
+    staging_.candidates = std::move(candidates);
+    staging_.highlighted = highlighted;
+    staging_.scroll_state = scroll_state;
+    staging_.scroll_start = scroll_start;
+    staging_.scroll_end = scroll_end;
+    staging_.touch(panel_field_t::candidates);
+    publish();
+}
+
+void WebviewCandidateWindow::set_layout(layout_t layout) {
+    trace_.write(TraceKind::set_layout, layout);
+    if (staging_.layout != layout) {
+        staging_.layout = layout;
+        staging_.touch(panel_field_t::layout);
+        publish();
+    }
+}
+
+void WebviewCandidateWindow::set_writing_mode(writing_mode_t mode) {
+    trace_.write(TraceKind::set_writing_mode, mode);
+    if (staging_.writing_mode != mode) {
+        staging_.writing_mode = mode;
+        staging_.touch(panel_field_t::writing_mode);
+        publish();
+    }
+}
+
+void WebviewCandidateWindow::set_paging_buttons(bool pageable, bool has_prev,
+                                                bool has_next) {
+    trace_.write(TraceKind::set_paging_buttons, pageable, has_prev, has_next);
+    if (staging_.pageable != pageable || staging_.has_prev != has_prev ||
+        staging_.has_next != has_next) {
+        staging_.pageable = pageable;
+        staging_.has_prev = has_prev;
+        staging_.has_next = has_next;
+        staging_.touch(panel_field_t::paging);
+        publish();
+    }
+}
+
+void WebviewCandidateWindow::publish() {
+    mailbox_.back().update_from(staging_);
+    if (!mailbox_.publish()) {
+        // Main thread hasn't picked up the previous snapshot, which is now
+        // replaced by this one, and a pickup is already scheduled.
+        return;
+    }
+#ifdef __EMSCRIPTEN__
+    mailbox_.consume();
+#else
+    // Only pick up the snapshot so that the copy is off the critical path of
+    // show(). Rendering waits for show() to avoid painting a stale position.
+    w_->dispatch([this, alive = std::weak_ptr<int>(alive_)] {
+        if (alive.lock()) {
+            mailbox_.consume();
+        }
+    });
+#endif
 }
 
 void WebviewCandidateWindow::scroll_key_action(
     scroll_key_action_t action) const {
+    trace_.write(TraceKind::scroll_key_action, action);
     invoke_js("scrollKeyAction", action);
 }
 
@@ -147,80 +361,275 @@ void WebviewCandidateWindow::answer_actions(
 }
 
 void WebviewCandidateWindow::set_theme(theme_t theme) const {
+    trace_.write(TraceKind::set_theme, theme);
     invoke_js("setTheme", theme);
 }
 
 void WebviewCandidateWindow::set_style(const void *style) const {
-    invoke_js("setStyle", static_cast<const char *>(style));
+    auto json = static_cast<const char *>(style);
+    trace_.write(TraceKind::set_style, std::string_view(json));
+    auto hash = std::hash<std::string_view>{}(json);
+    if (sent_style_hash_ == hash) {
+        return;
+    }
+    sent_style_hash_ = hash;
+    // Style decides how candidates are rendered, e.g. mark and paging
+    // buttons, and caret text which is only applied on preedit update. An
+    // unchanged list would be patched with nothing, so send it whole.
+    mark_dirty(panel_field_t::candidates);
+    mark_dirty(panel_field_t::preedit);
+    candidates_synced_ = false;
+    sent_candidates_.clear();
+    invoke_js("setStyle", json);
+}
+
+void WebviewCandidateWindow::invalidate_frame() const {
+    for (size_t i = 0; i < kPanelFieldCount; ++i) {
+        mark_dirty(static_cast<panel_field_t>(i));
+    }
+    sent_accent_color_generation_ = accent_color_generation_ - 1;
+    candidates_synced_ = false;
+    sent_candidates_.clear();
+    scroll_candidates_.clear();
 }
 
 void WebviewCandidateWindow::show(double x, double y, double height) const {
+    show_time_ = latency_clock::now();
+    trace_.write(TraceKind::show, x, y, height);
     caret_x_ = x;
     caret_y_ = y;
     caret_height_ = height;
-    // It's _resize which is called by resize that actually shows the window
-    if (hidden_) {
-        // Ideally this could be called only on first draw since we listen on
-        // accent color change, but the first draw may fail if webview is not
-        // warmed-up yet, and it won't be updated until user changes color.
-        set_accent_color();
-    }
     epoch += 1;
-    invoke_js("setLayout", layout_);
-    invoke_js("setWritingMode", writing_mode_);
-    invoke_js("updateInputPanel", preeditPreCaret_, hasCaret_,
-              preeditPostCaret_, auxUp_, auxDown_);
-    invoke_js("setCandidates", candidates_, highlighted_, pageable_, has_prev_,
-              has_next_, scroll_state_, scroll_start_, scroll_end_);
-    invoke_js("resize", epoch, 0., 0., false);
+    bridge_stats_.frames += 1;
+    // Pack what changed since last show() into one frame so that a keystroke
+    // costs a single script evaluation, and a caret move only a resize.
+    // Setters may run on another thread, so take the newest snapshot they
+    // published, in case its pickup is still queued.
+    mailbox_.consume();
+    const PanelState &state = panel_state();
+    invoke_js_with("applyFrame", [this, &state](std::string &out) {
+        js_object_writer frame(out);
+        if (sent_accent_color_generation_ != accent_color_generation_) {
+            frame.field("accentColor", accent_color_value());
+        }
+        if (dirty(panel_field_t::layout)) {
+            frame.field("layout", state.layout);
+        }
+        if (dirty(panel_field_t::writing_mode)) {
+            frame.field("writingMode", state.writing_mode);
+        }
+        if (dirty(panel_field_t::preedit)) {
+            frame.field("preedit",
+                        std::tie(state.preedit_pre_caret, state.has_caret,
+                                 state.preedit_post_caret));
+        }
+        if (dirty(panel_field_t::aux)) {
+            frame.field("aux", std::tie(state.aux_up, state.aux_down));
+        }
+        if (dirty(panel_field_t::candidates) || dirty(panel_field_t::paging) ||
+            dirty(panel_field_t::layout)) {
+            write_candidates(frame, state);
+        }
+        frame.field("resize", std::make_tuple(epoch, 0., 0., false, false));
+    });
+    std::copy(std::begin(state.generation), std::end(state.generation),
+              std::begin(sent_generation_));
+    sent_accent_color_generation_ = accent_color_generation_;
+}
+
+void WebviewCandidateWindow::write_candidates(js_object_writer &frame,
+                                              const PanelState &state) const {
+    // Scroll mode appends candidates on the page, so only diff in none state.
+    if (candidates_synced_ && state.scroll_state == scroll_state_t::none &&
+        state.layout == sent_layout_ && state.pageable == sent_pageable_ &&
+        !state.candidates.empty()) {
+        auto splices = diff_candidates(sent_candidates_, state.candidates);
+        if (!splices.empty() || state.highlighted != sent_highlighted_ ||
+            state.has_prev != sent_has_prev_ ||
+            state.has_next != sent_has_next_) {
+            frame.field("candidatesPatch",
+                        std::tie(splices, state.highlighted, state.has_prev,
+                                 state.has_next));
+        }
+    } else {
+        frame.field("candidates",
+                    std::tie(state.candidates, state.highlighted,
+                             state.pageable, state.has_prev, state.has_next,
+                             state.scroll_state, state.scroll_start,
+                             state.scroll_end));
+        sent_layout_ = state.layout;
+        sent_pageable_ = state.pageable;
+        // Mirror what the page appends to or clears.
+        if (state.scroll_state != scroll_state_t::scrolling ||
+            state.scroll_start) {
+            scroll_candidates_.clear();
+        }
+        if (state.scroll_state == scroll_state_t::scrolling) {
+            scroll_candidates_.insert(scroll_candidates_.end(),
+                                      state.candidates.begin(),
+                                      state.candidates.end());
+        }
+    }
+    candidates_synced_ =
+        state.scroll_state == scroll_state_t::none && !state.candidates.empty();
+    sent_candidates_ = state.candidates;
+    sent_highlighted_ = state.highlighted;
+    sent_has_prev_ = state.has_prev;
+    sent_has_next_ = state.has_next;
 }
 
 void WebviewCandidateWindow::update_input_panel(formatted preedit, int caret,
                                                 formatted auxUp,
                                                 formatted auxDown) {
-    preeditPreCaret_.clear();
-    preeditPostCaret_.clear();
+    trace_.write(TraceKind::update_input_panel, preedit, caret, auxUp,
+                 auxDown);
+    formatted preCaret;
+    formatted postCaret;
     int index = 0;
     for (auto &slice : preedit) {
         auto size =
             (int)slice.first
                 .size(); // ensure signed comparison since caret may be -1
         if (caret <= index) {
-            preeditPostCaret_.emplace_back(std::move(slice));
+            postCaret.emplace_back(std::move(slice));
         } else if (caret < index + size) {
-            preeditPreCaret_.emplace_back(slice.first.substr(0, caret - index),
-                                          slice.second);
-            preeditPostCaret_.emplace_back(slice.first.substr(caret - index),
-                                           slice.second);
+            preCaret.emplace_back(slice.first.substr(0, caret - index),
+                                  slice.second);
+            postCaret.emplace_back(slice.first.substr(caret - index),
+                                   slice.second);
         } else {
-            preeditPreCaret_.emplace_back(std::move(slice));
+            preCaret.emplace_back(std::move(slice));
         }
         index += size;
     }
-    preeditPreCaret_.shrink_to_fit();
-    preeditPostCaret_.shrink_to_fit();
-    hasCaret_ = caret >= 0;
+    bool hasCaret = caret >= 0;
+    bool changed = false;
+    if (preCaret != staging_.preedit_pre_caret ||
+        postCaret != staging_.preedit_post_caret ||
+        hasCaret != staging_.has_caret) {
+        staging_.preedit_pre_caret = std::move(preCaret);
+        staging_.preedit_post_caret = std::move(postCaret);
+        staging_.has_caret = hasCaret;
+        staging_.touch(panel_field_t::preedit);
+        changed = true;
+    }
 
-    auxUp_ = std::move(auxUp);
-    auxDown_ = std::move(auxDown);
+    if (auxUp != staging_.aux_up || auxDown != staging_.aux_down) {
+        staging_.aux_up = std::move(auxUp);
+        staging_.aux_down = std::move(auxDown);
+        staging_.touch(panel_field_t::aux);
+        changed = true;
+    }
+    if (changed) {
+        publish();
+    }
 }
 
 void WebviewCandidateWindow::copy_html() const { invoke_js("copyHTML"); }
 
+void WebviewCandidateWindow::prewarm(std::function<void()> done) {
+    prewarm_done_ = std::move(done);
+    if (!loaded_) {
+        prewarm_pending_ = true;
+        return;
+    }
+    // Not from the page, whose panel isn't hidden after hide() on Linux.
+    invoke_js("prewarm", hidden_);
+}
+
+bool WebviewCandidateWindow::start_recording(const std::string &path) {
+    return trace_.open(path);
+}
+
+void WebviewCandidateWindow::stop_recording() { trace_.close(); }
+
+std::string WebviewCandidateWindow::call_from_page(std::string_view call) {
+    trace_.write(TraceKind::js_call, call);
+    return handlers_.call(call);
+}
+
+void WebviewCandidateWindow::set_memory_policy(MemoryPolicy policy) {
+    memory_policy_ = policy;
+    apply_memory_policy();
+}
+
+void WebviewCandidateWindow::release_memory() const {
+    if (!hidden_) {
+        return;
+    }
+    invoke_js("hidePanel");
+    invalidate_frame();
+    std::vector<Candidate>().swap(sent_candidates_);
+    std::vector<Candidate>().swap(scroll_candidates_);
+    std::string().swap(js_buffer_);
+    release_webkit_memory();
+}
+
+std::string WebviewCandidateWindow::dump_latency_stats() const {
+    std::string out;
+    write_js(out, latency_stats_);
+    return out;
+}
+
 #ifndef __EMSCRIPTEN__
+// Bridges of windows that use the curl API. They share the transfer manager
+// and the main loop, whose callbacks are posted through any of them.
+static std::mutex curl_windows_mutex;
+static std::vector<Bridge *> curl_windows;
+
+static void dispatch_curl_callback(std::function<void()> f) {
+    {
+        std::lock_guard g(curl_windows_mutex);
+        if (!curl_windows.empty()) {
+            curl_windows.front()->dispatch(std::move(f));
+            return;
+        }
+    }
+    // No window to post to, so run it here rather than drop it.
+    f();
+}
+
+// Keep w in curl_windows until the result is dropped.
+static std::shared_ptr<void> register_curl_window(Bridge *w) {
+    std::lock_guard g(curl_windows_mutex);
+    curl_windows.push_back(w);
+    return std::shared_ptr<void>(w, [](Bridge *w) {
+        std::lock_guard g(curl_windows_mutex);
+        std::erase(curl_windows, w);
+    });
+}
+
 void WebviewCandidateWindow::set_api(uint64_t apis) {
     if (apis & kCurl) {
-        w_->bind(
-            "curl",
-            [this](std::string id, std::string req, void *) {
-                api_curl(id, req);
-            },
-            nullptr);
+        if (!curl_registration_) {
+            curl_registration_ = register_curl_window(w_.get());
+        }
+        // Run curl callbacks on main thread, off the transfer worker.
+        CurlMultiManager::shared().set_dispatch(dispatch_curl_callback);
+        w_->bind_async("curl", [this](std::string id, std::string req) {
+            api_curl(id, req);
+        });
+        bind("curlAck", [this](std::string stream, size_t bytes) {
+            ack_curl_stream(stream, bytes);
+        });
+        bind("curlClose",
+             [this](std::string stream) { close_curl_stream(stream); });
+        bind("curlCancel", [this](std::string key) { api_curl_cancel(key); });
     } else {
         w_->unbind("curl");
+        handlers_.remove("curlAck");
+        handlers_.remove("curlClose");
+        handlers_.remove("curlCancel");
+        curl_registration_.reset();
     }
 }
 
+void WebviewCandidateWindow::set_curl_cache(size_t capacity,
+                                            const std::string &path) {
+    CurlCache::shared().set_capacity(capacity);
+    CurlCache::shared().set_file(path);
+}
+
 void WebviewCandidateWindow::load_plugins(
     const std::vector<std::string> &names) {
     invoke_js("loadPlugins", names);
@@ -233,6 +642,41 @@ enum PromiseResolution {
     kRejected,
 };
 
+// Body of a streamed curl response on its way to JS. Received bytes count
+// against the window until JS acknowledges that it has consumed them.
+struct CurlStream {
+    std::mutex m;
+    std::string pending; // Not sent to JS yet.
+    size_t unacked = 0;
+    bool paused = false;
+    bool flush_scheduled = false;
+    bool binary = false;
+    uint64_t transfer = 0; // Main thread only.
+};
+
+// Bound of memory held for a stream that JS doesn't keep up with.
+static constexpr size_t kCurlStreamWindow = 256 << 10;
+
+// Written directly rather than through nlohmann::json, so that a large
+// body is copied once, and base64 needs no escaping.
+static std::string curl_response(long status, const std::string &data,
+                                 bool binary) {
+    std::string out;
+    out.reserve((binary ? (data.size() + 2) / 3 * 4 : data.size()) + 32);
+    out += "{\"status\":";
+    write_js(out, status);
+    out += ",\"data\":";
+    if (binary) {
+        out += '"';
+        base64_encode(data, out);
+        out += '"';
+    } else {
+        write_js(out, data);
+    }
+    out += '}';
+    return out;
+}
+
 void WebviewCandidateWindow::api_curl(std::string id, std::string req) {
     auto j = nlohmann::json::parse(req);
     std::string url;
@@ -246,13 +690,27 @@ void WebviewCandidateWindow::api_curl(std::string id, std::string req) {
     }
     auto args = j[1];
 
-    CURL *curl = curl_easy_init();
+    // A new request of the same key aborts the old one, whose result would
+    // be stale by the time it arrives.
+    std::string supersede;
+    if (args.contains("supersede") && args["supersede"].is_string()) {
+        supersede = args["supersede"];
+        api_curl_cancel(supersede);
+    }
+
+    CURL *curl = CurlMultiManager::shared().acquire();
     if (!curl) {
         w_->resolve(id, kRejected, "\"Failed to initialize curl\"");
         return;
     }
 
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    if (url.rfind("https://", 0) == 0) {
+        // Wait for a connection being made to the host, which may turn out
+        // to be HTTP/2, instead of opening another one. Only TLS negotiates
+        // HTTP/2, and waiting would serialize plain HTTP/1.1.
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
 
     bool binary = false;
     std::unordered_map<std::string, std::string> headers;
@@ -275,19 +733,34 @@ void WebviewCandidateWindow::api_curl(std::string id, std::string req) {
             curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
         } else {
             w_->resolve(id, kRejected, nlohmann::json("Unknown HTTP method"));
-            curl_easy_cleanup(curl);
+            CurlMultiManager::shared().release(curl);
             return;
         }
     }
 
     // json, data
+    std::string body;
     if (args.contains("json")) {
-        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS,
-                         args["json"].dump().c_str());
+        body = args["json"].dump();
+        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
         headers["Content-Type"] = "application/json";
     } else if (args.contains("data") && args["data"].is_string()) {
-        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS,
-                         args["data"].get<std::string>().c_str());
+        body = args["data"].get<std::string>();
+        if (args.contains("binaryData") && args["binaryData"].is_boolean() &&
+            args["binaryData"].get<bool>()) {
+            std::string decoded;
+            if (!base64_decode(body, decoded)) {
+                w_->resolve(id, kRejected,
+                            nlohmann::json("Invalid base64 data").dump());
+                CurlMultiManager::shared().release(curl);
+                return;
+            }
+            body = std::move(decoded);
+        }
+        // Set before COPYPOSTFIELDS so that it doesn't stop at a null byte.
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE,
+                         static_cast<curl_off_t>(body.size()));
+        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
     }
     if (args.contains("binary") && args["binary"].is_boolean()) {
         binary = args["binary"];
@@ -304,11 +777,49 @@ void WebviewCandidateWindow::api_curl(std::string id, std::string req) {
             }
         }
     }
+    // cache
+    std::string stream;
+    if (args.contains("stream") && args["stream"].is_string()) {
+        stream = args["stream"];
+    }
+    // Streams are consumed as they arrive, so there's nothing to cache.
+    bool use_cache = stream.empty() &&
+                     (method == "GET" || method == "POST") &&
+                     !(args.contains("cache") && args["cache"].is_boolean() &&
+                       !args["cache"].get<bool>());
+    std::string cache_key;
+    bool revalidating = false;
+    if (use_cache) {
+        cache_key = CurlCache::make_key(method, url, headers, body);
+        auto cached = CurlCache::shared().lookup(cache_key);
+        if (cached && cached->fresh(time(nullptr))) {
+            // Resolve right away, without going through curl's thread.
+            std::cerr << method << " " << url << " " << cached->status
+                      << " (cached)" << std::endl;
+            w_->resolve(id, kFulfilled,
+                        curl_response(cached->status, cached->data, binary));
+            CurlMultiManager::shared().release(curl);
+            return;
+        }
+        if (cached && cached->revalidatable()) {
+            if (!cached->etag.empty()) {
+                headers["If-None-Match"] = cached->etag;
+            }
+            if (!cached->last_modified.empty()) {
+                headers["If-Modified-Since"] = cached->last_modified;
+            }
+            revalidating = true;
+        }
+    }
+
     for (const auto &[key, value] : headers) {
         std::string s = key + ": " + value;
         hlist = curl_slist_append(hlist, s.c_str());
     }
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hlist);
+    // Freed with the callback, which the manager keeps until the transfer is
+    // over, whether it's called or dropped.
+    std::shared_ptr<curl_slist> header_list(hlist, curl_slist_free_all);
 
     // timeout
     if (args.contains("timeout") && args["timeout"].is_number_integer()) {
@@ -316,33 +827,170 @@ void WebviewCandidateWindow::api_curl(std::string id, std::string req) {
         curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
     }
 
-    CurlMultiManager::shared().add(curl, [this, id, url, method,
-                                          binary](CURLcode res, CURL *curl,
-                                                  const std::string &data) {
-        try {
-            if (res == CURLE_OK) {
-                long status = 0;
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-                nlohmann::json j{
-                    {"status", status},
-                    {"data", !binary ? data : base64(data)},
-                };
-                std::cerr << method << " " << url << " " << status << std::endl;
-                w_->resolve(id, kFulfilled, j.dump());
-            } else {
-                std::string errmsg = "CURL error: ";
-                errmsg += curl_easy_strerror(res);
-                w_->resolve(id, kRejected,
-                            nlohmann::json(errmsg).dump().c_str());
+    // priority
+    auto priority = CurlPriority::kNormal;
+    if (args.contains("priority") && args["priority"].is_string()) {
+        if (args["priority"] == "interactive") {
+            priority = CurlPriority::kInteractive;
+        } else if (args["priority"] == "bulk") {
+            priority = CurlPriority::kBulk;
+        }
+    }
+
+    std::shared_ptr<CurlStream> s;
+    CurlMultiManager::DataCallback on_data;
+    auto alive = std::weak_ptr<int>(alive_);
+    if (!stream.empty()) {
+        s = std::make_shared<CurlStream>();
+        s->binary = binary;
+        on_data = [this, stream, s, alive](const char *data,
+                                            size_t size) -> size_t {
+            if (alive.expired()) {
+                // Anything but size fails the transfer.
+                return 0;
+            }
+            {
+                std::lock_guard g(s->m);
+                if (s->unacked >= kCurlStreamWindow) {
+                    // curl stops reading the socket, so TCP flow control
+                    // throttles the server until JS catches up.
+                    s->paused = true;
+                    return CURL_WRITEFUNC_PAUSE;
+                }
+                s->pending.append(data, size);
+                s->unacked += size;
+                if (s->flush_scheduled) {
+                    return size;
+                }
+                s->flush_scheduled = true;
+            }
+            // Not through w_, which may be gone by now on this thread.
+            dispatch_curl_callback([this, stream, s, alive] {
+                if (alive.lock()) {
+                    flush_curl_stream(stream, *s, false);
+                }
+            });
+            return size;
+        };
+    }
+
+    auto transfer = CurlMultiManager::shared().add(
+        curl,
+        [this, id, url, method, binary, use_cache, cache_key, revalidating,
+         stream, s, alive, header_list](CURLcode res, CURL *curl, const std::string &data) {
+            int resolution = kFulfilled;
+            std::string result;
+            try {
+                if (res == CURLE_OK) {
+                    long status = 0;
+                    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                    std::cerr << method << " " << url << " " << status
+                              << std::endl;
+                    std::optional<CachedResponse> cached;
+                    if (status == 304 && revalidating) {
+                        cached =
+                            CurlCache::shared().revalidate(cache_key, curl);
+                    } else if (use_cache) {
+                        CurlCache::shared().store(cache_key, method, curl,
+                                                  status, data);
+                    }
+                    result = cached ? curl_response(cached->status,
+                                                    cached->data, binary)
+                                    : curl_response(status, data, binary);
+                } else if (res == CURLE_ABORTED_BY_CALLBACK) {
+                    std::cerr << method << " " << url << " cancelled"
+                              << std::endl;
+                    resolution = kRejected;
+                    result = "\"Cancelled\"";
+                } else {
+                    std::string errmsg = "CURL error: ";
+                    errmsg += curl_easy_strerror(res);
+                    resolution = kRejected;
+                    result = nlohmann::json(errmsg).dump();
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "[JS] curl callback throws " << e.what() << "\n";
+                resolution = kRejected;
+                result = nlohmann::json(e.what()).dump();
+            } catch (...) {
+                std::cerr
+                    << "[JS] FATAL! Unhandled exception in curl callback\n";
+                std::terminate();
             }
-        } catch (const std::exception &e) {
-            std::cerr << "[JS] curl callback throws " << e.what() << "\n";
-            w_->resolve(id, kRejected, nlohmann::json(e.what()).dump());
-        } catch (...) {
-            std::cerr << "[JS] FATAL! Unhandled exception in curl callback\n";
-            std::terminate();
+            if (!alive.lock()) {
+                return;
+            }
+            if (s) {
+                // Settle after the rest of the body.
+                flush_curl_stream(stream, *s, true);
+                curl_streams_.erase(stream);
+            }
+            w_->resolve(id, resolution, result);
+        },
+        std::move(on_data), priority);
+    if (!supersede.empty()) {
+        curl_transfers_[supersede] = transfer;
+    }
+    if (s) {
+        s->transfer = transfer;
+        curl_streams_[stream] = s;
+    }
+}
+
+void WebviewCandidateWindow::api_curl_cancel(const std::string &key) {
+    auto iter = curl_transfers_.find(key);
+    if (iter != curl_transfers_.end()) {
+        // No-op if it has finished.
+        CurlMultiManager::shared().cancel(iter->second);
+        curl_transfers_.erase(iter);
+    }
+}
+
+void WebviewCandidateWindow::flush_curl_stream(const std::string &id,
+                                               CurlStream &stream, bool last) {
+    std::string chunk;
+    {
+        std::lock_guard g(stream.m);
+        stream.flush_scheduled = false;
+        size_t n = last            ? stream.pending.size()
+                   : stream.binary ? stream.pending.size() / 3 * 3
+                                   : utf8_complete_length(stream.pending);
+        chunk = stream.pending.substr(0, n);
+        stream.pending.erase(0, n);
+    }
+    if (!chunk.empty()) {
+        invoke_js("curlChunk", id, stream.binary ? base64(chunk) : chunk,
+                  chunk.size());
+    }
+}
+
+void WebviewCandidateWindow::ack_curl_stream(const std::string &id,
+                                             size_t bytes) {
+    auto iter = curl_streams_.find(id);
+    if (iter == curl_streams_.end()) {
+        return;
+    }
+    auto &stream = *iter->second;
+    bool resume;
+    {
+        std::lock_guard g(stream.m);
+        stream.unacked -= std::min(bytes, stream.unacked);
+        // Wait for half of the window to avoid pausing on every chunk.
+        resume = stream.paused && stream.unacked <= kCurlStreamWindow / 2;
+        if (resume) {
+            stream.paused = false;
         }
-    });
+    }
+    if (resume) {
+        CurlMultiManager::shared().resume(stream.transfer);
+    }
+}
+
+void WebviewCandidateWindow::close_curl_stream(const std::string &id) {
+    auto iter = curl_streams_.find(id);
+    if (iter != curl_streams_.end()) {
+        CurlMultiManager::shared().cancel(iter->second->transfer);
+    }
 }
 #endif
 
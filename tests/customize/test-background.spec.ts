@@ -21,3 +21,14 @@ test('Local image', async ({ page }) => {
   await setStyle(page, { Background: { ImageUrl: image } })
   await expect(hoverables(page)).toHaveCSS('background-image', /url\("fcitx:\/\/test\.png\?r=\d+(\.\d+)?"\)/)
 })
+
+test('Local image is not reloaded on switching back', async ({ page }) => {
+  await init(page)
+  const image = 'fcitx://test.png'
+  await setStyle(page, { Background: { ImageUrl: image } })
+  const url = await hoverables(page).evaluate(el => getComputedStyle(el).backgroundImage)
+  await setStyle(page, { Background: { ImageUrl: '' } })
+  await expect(hoverables(page)).toHaveCSS('background-image', 'none')
+  await setStyle(page, { Background: { ImageUrl: image } })
+  await expect(hoverables(page)).toHaveCSS('background-image', url)
+})
@@ -196,3 +196,47 @@ test('WebKit prefix', async ({ page }) => {
   // macOS 13 uses WebKit 16, which doesn't support backdrop-filter.
   expect(style.includes('-webkit-backdrop-filter:var(--backdrop-filter,blur(16px))')).toBe(true)
 })
+
+test('Apply frame', async ({ page }) => {
+  await init(page)
+  await page.evaluate(() => window.fcitx.applyFrame({
+    layout: 1,
+    writingMode: 0,
+    preedit: [[], true, [['shu', 0]]],
+    aux: [[], []],
+    candidates: [[
+      { text: '一帧', label: '1', comment: '', actions: [], spaceBetweenComment: true },
+      { text: '一次', label: '2', comment: '', actions: [], spaceBetweenComment: true },
+    ], 1, false, false, false, 0, false, false],
+    resize: [1, 0, 0, false, false],
+  }))
+
+  await expect(page.locator('.fcitx-hoverables')).toContainClass('fcitx-vertical')
+  await expect(page.locator('.fcitx-post-caret')).toHaveText('shu')
+  await expect(candidate(page, 1)).toContainClass('fcitx-highlighted')
+  const cppCalls = await getCppCalls(page)
+  expect(cppCalls.some(call => JSON.stringify(call).startsWith('{"resize":[1,'))).toBe(true)
+})
+
+test('Patch candidates', async ({ page }) => {
+  await init(page)
+  await setLayout(page, VERTICAL)
+  await setCandidates(page, Array.from({ length: 10 }).map((_, i) => ({ text: `候选${i}`, label: `${(i + 1) % 10}`, comment: '' })), 0, true)
+  await page.evaluate(() => document.querySelectorAll('.fcitx-candidate').forEach(el => el.setAttribute('data-kept', '')))
+
+  // Highlight only.
+  await page.evaluate(() => window.fcitx.applyFrame({ candidatesPatch: [[], 3, true, true] }))
+  await expect(candidate(page, 0)).not.toContainClass('fcitx-highlighted')
+  await expect(candidate(page, 3)).toContainClass('fcitx-highlighted-original')
+  await expect(page.locator('.fcitx-next .fcitx-paging-inner')).toContainClass('fcitx-hoverable-inner')
+  await expect(page.locator('.fcitx-candidate[data-kept]')).toHaveCount(10)
+
+  // Replace 1 and delete 2, so only one node is rebuilt.
+  await page.evaluate(() => window.fcitx.applyFrame({ candidatesPatch: [[[1, 1, [{ text: '新', label: '2', comment: '注释', actions: [], spaceBetweenComment: true }]], [8, 2, []]], 1, true, true] }))
+  await expect(page.locator('.fcitx-candidate')).toHaveCount(8)
+  await expect(page.locator('.fcitx-candidate[data-kept]')).toHaveCount(7)
+  await expect(candidate(page, 1).locator('.fcitx-comment')).toHaveText('注释')
+  await expect(candidate(page, 1)).toContainClass('fcitx-highlighted')
+  await expect(candidate(page, 7)).toContainClass('fcitx-candidate-last')
+  await expect(page.locator('.fcitx-divider')).toHaveCount(9) // Including the one before paging buttons.
+})
@@ -0,0 +1,34 @@
+import type { Page } from '@playwright/test'
+import {
+  expect,
+  test,
+} from '@playwright/test'
+import { getCppCalls, init, panel, setCandidates, theme } from './util'
+
+async function prewarmed(page: Page) {
+  return (await getCppCalls(page)).filter(call => 'prewarmed' in call).map(call => call.prewarmed)
+}
+
+test('Prewarm after load', async ({ page }) => {
+  await init(page)
+  // As C++ does right after onload, before the window is shown.
+  await page.evaluate(() => window.fcitx.prewarm(true))
+  const calls = await prewarmed(page)
+  expect(calls.length).toEqual(1)
+  const [ms, rendered] = calls[0]
+  expect(rendered).toEqual(true)
+  expect(ms).toBeGreaterThan(0)
+
+  // Nothing of it is left.
+  await expect(theme(page)).toContainClass('fcitx-hidden')
+  await expect(panel(page)).toContainClass('fcitx-horizontal-tb')
+  await expect(page.locator('.fcitx-candidate')).toHaveCount(0)
+})
+
+test('No prewarm while shown', async ({ page }) => {
+  await init(page)
+  await setCandidates(page, [{ text: '一' }], 0)
+  await page.evaluate(() => window.fcitx.prewarm(false))
+  expect(await prewarmed(page)).toEqual([[0, false]])
+  await expect(page.locator('.fcitx-candidate')).toHaveCount(1)
+})
@@ -0,0 +1,127 @@
+import type { Page } from '@playwright/test'
+import {
+  expect,
+  test,
+} from '@playwright/test'
+import { getCppCalls, init } from './util'
+
+const KEYSTROKES = 50
+
+interface LayoutStats {
+  // Reads of geometry or computed style.
+  reads: number
+  // Of which computed style.
+  styleReads: number
+  // Of which came after the DOM was mutated, so had to lay out synchronously.
+  forced: number
+  // Callbacks of a ResizeObserver on decoration, like the page's own.
+  observed: number
+}
+
+async function instrument(page: Page) {
+  await page.evaluate(() => {
+    const stats: LayoutStats = { reads: 0, styleReads: 0, forced: 0, observed: 0 }
+    ;(window as any).layoutStats = stats
+    const observer = new MutationObserver(() => {})
+    observer.observe(document, { subtree: true, childList: true, attributes: true, characterData: true })
+    function count() {
+      stats.reads += 1
+      if (observer.takeRecords().length) {
+        stats.forced += 1
+      }
+    }
+    const getBoundingClientRect = Element.prototype.getBoundingClientRect
+    Element.prototype.getBoundingClientRect = function () {
+      count()
+      return getBoundingClientRect.call(this)
+    }
+    const getComputedStyle = window.getComputedStyle
+    window.getComputedStyle = (element, pseudoElement) => {
+      count()
+      stats.styleReads += 1
+      return getComputedStyle(element, pseudoElement)
+    }
+    new ResizeObserver(() => {
+      stats.observed += 1
+    }).observe(document.querySelector('.fcitx-decoration')!)
+  })
+}
+
+function getStats(page: Page) {
+  return page.evaluate(() => ({ ...(window as any).layoutStats }) as LayoutStats)
+}
+
+function keystroke(page: Page, i: number) {
+  const preedit = 'n'.repeat(i % 8 + 1)
+  return page.evaluate(({ i, preedit }) => {
+    window.fcitx.applyFrame({
+      preedit: [[], true, [[preedit, 0]]],
+      candidates: [Array.from({ length: 5 }).map((_, j) => (
+        { text: `${preedit}${j}`, label: `${j + 1}`, comment: '', actions: [], spaceBetweenComment: true }
+      )), 0, false, false, false, 0, false, false],
+      resize: [i, 0, 0, false, false],
+    })
+  }, { i, preedit })
+}
+
+function nextFrame(page: Page) {
+  // Let ResizeObserver run.
+  return page.evaluate(() => new Promise(resolve => requestAnimationFrame(() => setTimeout(resolve))))
+}
+
+async function countResizes(page: Page, since: number) {
+  return (await getCppCalls(page)).slice(since).filter(call => 'resize' in call).length
+}
+
+test('Forced layouts per keystroke', async ({ page }) => {
+  await init(page)
+  await instrument(page)
+  // Style metrics are read once for the current style.
+  await keystroke(page, 0)
+  await nextFrame(page)
+
+  const callsBefore = (await getCppCalls(page)).length
+  const start = await getStats(page)
+  for (let i = 1; i <= KEYSTROKES; ++i) {
+    await keystroke(page, i)
+    await nextFrame(page)
+  }
+  const end = await getStats(page)
+
+  expect(end.forced - start.forced).toBeLessThanOrEqual(KEYSTROKES)
+  expect(end.styleReads - start.styleReads).toBe(0)
+  // Each keystroke resizes decoration, but ResizeObserver's callback finds the geometry show() already sent.
+  expect(end.observed - start.observed).toBeGreaterThanOrEqual(KEYSTROKES)
+  expect(await countResizes(page, callsBefore)).toBe(KEYSTROKES)
+})
+
+test('Style change reads style again', async ({ page }) => {
+  await init(page)
+  await instrument(page)
+  await keystroke(page, 0)
+  await nextFrame(page)
+
+  const start = await getStats(page)
+  await page.evaluate(() => window.fcitx.setTheme(2))
+  await keystroke(page, 1)
+  await nextFrame(page)
+  const end = await getStats(page)
+  expect(end.styleReads - start.styleReads).toBeGreaterThan(0)
+})
+
+test('Drop same epoch and geometry', async ({ page }) => {
+  await init(page)
+  await keystroke(page, 1)
+  await nextFrame(page)
+
+  const callsBefore = (await getCppCalls(page)).length
+  await page.evaluate(() => window.fcitx.resize(1, 0, 0, false, false))
+  expect(await countResizes(page, callsBefore)).toBe(0)
+
+  // Same epoch with new geometry is still sent.
+  await page.evaluate(() => {
+    document.querySelector<HTMLElement>('.fcitx-panel')!.style.padding = '20px'
+    window.fcitx.resize(1, 0, 0, false, false)
+  })
+  expect(await countResizes(page, callsBefore)).toBe(1)
+})
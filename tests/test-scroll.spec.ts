@@ -1,5 +1,7 @@
+import type { Page } from '@playwright/test'
 import test, { expect } from '@playwright/test'
-import { candidate, followHostTheme, getBox, getCppCalls, init, panel, scroll, scrollExpand, setStyle } from './util'
+import { DOWN, PAGE_UP } from '../page/constant'
+import { candidate, followHostTheme, getBox, getCppCalls, hoverables, init, panel, scroll, scrollExpand, setStyle } from './util'
 
 test.describe('Actively expand', () => {
   const cases = [
@@ -194,3 +196,147 @@ test('Fill rest space temporarily and shrink when more candidates come', async (
   expect((await getBox(forthDivider)).width).toBeGreaterThanOrEqual(262)
   expect((await getBox(thirdDivider)).width).toEqual(0)
 })
+
+test.describe('Virtualized', () => {
+  // Default MaxRowCount and MaxColumnCount, and each candidate takes 1 cell.
+  const MAX_ROW = 6
+  const MAX_COLUMN = 6
+  // Rows in view, MAX_ROW on each side, and up to 2 * MAX_ROW left behind before rebuilding.
+  const MAX_RENDERED = (5 * MAX_ROW + 2) * MAX_COLUMN
+  const TOTAL = 1050
+  // At most 2 characters, which fit in a cell.
+  const texts = Array.from({ length: TOTAL }).map((_, i) => i.toString(36))
+
+  async function expandAll(page: Page) {
+    await scrollExpand(page, texts.slice(0, (MAX_ROW + 1) * MAX_COLUMN))
+    for (let start = (MAX_ROW + 1) * MAX_COLUMN; start < TOTAL; start += MAX_ROW * MAX_COLUMN) {
+      const end = Math.min(start + MAX_ROW * MAX_COLUMN, TOTAL)
+      await scroll(page, texts.slice(start, end), end === TOTAL)
+    }
+  }
+
+  // Like C++, which answers scrollRange asynchronously from the candidates it kept.
+  function answerScrollRange(page: Page) {
+    return page.evaluate(({ texts }) => {
+      const fcitx = window.fcitx
+      window.fcitx = Object.assign((...args: [string, ...any[]]) => {
+        fcitx(...args)
+        if (args[0] === 'scrollRange') {
+          const [, session, start, length] = args
+          setTimeout(() => window.fcitx.setScrollRange(session, start, texts.slice(start, start + length).map(text =>
+            ({ text, label: '', comment: '', actions: [], spaceBetweenComment: true }))))
+        }
+      }, fcitx)
+    }, { texts })
+  }
+
+  function settle(page: Page) {
+    return page.evaluate(() => new Promise(resolve => requestAnimationFrame(() => setTimeout(resolve))))
+  }
+
+  function scrollTo(page: Page, top: number) {
+    return page.evaluate((top) => {
+      document.querySelector('.fcitx-hoverables')!.scrollTop = top
+    }, top)
+  }
+
+  test('1000+ candidates', async ({ page }) => {
+    await init(page)
+    await answerScrollRange(page)
+    await expandAll(page)
+    const pane = hoverables(page)
+    const candidates = pane.locator('.fcitx-candidate')
+    expect(await candidates.count()).toBeLessThanOrEqual(MAX_RENDERED)
+
+    const { scrollHeight, clientHeight } = await pane.evaluate(el => ({ scrollHeight: el.scrollHeight, clientHeight: el.clientHeight }))
+    const rowHeight = (await getBox(candidate(page, 0))).height
+    expect(scrollHeight, 'Spacers keep the height of all rows').toBeGreaterThanOrEqual(TOTAL / MAX_COLUMN * rowHeight)
+
+    for (const top of [scrollHeight / 3, scrollHeight, scrollHeight / 2, 0, scrollHeight - clientHeight]) {
+      await scrollTo(page, top)
+      await settle(page)
+      await settle(page)
+      expect(await candidates.count()).toBeLessThanOrEqual(MAX_RENDERED)
+      // The first candidate in view is the one at its offset, and not a placeholder.
+      const index = await pane.evaluate((el) => {
+        const { top } = el.getBoundingClientRect()
+        const cand = [...el.querySelectorAll('.fcitx-candidate')].find(cand => cand.getBoundingClientRect().bottom > top + 1)!
+        return Number.parseInt(cand.querySelector('.fcitx-text')!.textContent!, 36)
+      })
+      const expected = Math.min(Math.floor(top / rowHeight), TOTAL / MAX_COLUMN - Math.floor(clientHeight / rowHeight)) * MAX_COLUMN
+      expect(Math.abs(index - expected)).toBeLessThanOrEqual(MAX_COLUMN)
+    }
+  })
+
+  test('Keyboard navigation across rendered rows', async ({ page }) => {
+    await init(page)
+    await answerScrollRange(page)
+    await expandAll(page)
+    // Rows near the end were rendered last, so the top is fetched again by scrollRange.
+    await scrollTo(page, 1e6)
+    await settle(page)
+    await scrollTo(page, 0)
+    await settle(page)
+    await settle(page)
+
+    const paneBox = await getBox(hoverables(page))
+    async function expectHighlighted(index: number) {
+      const highlighted = page.locator('.fcitx-highlighted')
+      await expect(highlighted).toHaveCount(1)
+      await expect(highlighted.locator('.fcitx-text')).toHaveText(texts[index])
+      const box = await getBox(highlighted)
+      expect(box.y).toBeGreaterThanOrEqual(paneBox.y - 1)
+      expect(box.y + box.height).toBeLessThanOrEqual(paneBox.y + paneBox.height + 1)
+    }
+
+    const rows = 4 * MAX_ROW
+    for (let row = 1; row <= rows; ++row) {
+      await page.evaluate(action => window.fcitx.scrollKeyAction(action), DOWN)
+      await settle(page)
+      await expectHighlighted(row * MAX_COLUMN)
+    }
+    expect(await hoverables(page).locator('.fcitx-candidate').count()).toBeLessThanOrEqual(MAX_RENDERED)
+
+    // A page keeps one row in view.
+    const pageUpRows = [19, 14, 9, 4, 0]
+    for (const row of pageUpRows) {
+      await page.evaluate(action => window.fcitx.scrollKeyAction(action), PAGE_UP)
+      await settle(page)
+      await expectHighlighted(row * MAX_COLUMN)
+    }
+    const cppCalls = await getCppCalls(page)
+    expect(cppCalls.filter(call => 'highlight' in call).map(call => call.highlight[0]).slice(-rows - pageUpRows.length)).toEqual([
+      ...Array.from({ length: rows }).map((_, i) => (i + 1) * MAX_COLUMN),
+      ...pageUpRows.map(row => row * MAX_COLUMN),
+    ])
+  })
+
+  test('Ignore stale scrollRange', async ({ page }) => {
+    await init(page)
+    await expandAll(page)
+    await scrollTo(page, 1e6)
+    await settle(page)
+    await scrollTo(page, 0)
+    await settle(page)
+
+    const requests = (await getCppCalls(page)).filter(call => 'scrollRange' in call).map(call => call.scrollRange)
+    const [session, start, length] = requests[requests.length - 1]
+    expect(start).toEqual(0)
+    expect(length).toBeGreaterThan(0)
+    const first = candidate(page, 0)
+    await expect(first, 'Placeholder').toHaveText('')
+
+    const cands = texts.slice(start, start + length).map(text => ({ text, label: '', comment: '', actions: [], spaceBetweenComment: true }))
+    await page.evaluate(({ session, start, cands }) => window.fcitx.setScrollRange(session - 1, start, cands), { session, start, cands })
+    await expect(first, 'Response for previous candidates').toHaveText('')
+
+    await page.evaluate(({ session, start, cands }) => window.fcitx.setScrollRange(session, start, cands), { session, start, cands })
+    await expect(first.locator('.fcitx-text')).toHaveText(texts[0])
+
+    // New candidates start a new session.
+    await scrollExpand(page, ['n0', 'n1'])
+    await page.evaluate(({ session, start, cands }) => window.fcitx.setScrollRange(session, start, cands), { session, start, cands })
+    await expect(candidate(page, 0).locator('.fcitx-text')).toHaveText('n0')
+    await expect(hoverables(page).locator('.fcitx-candidate')).toHaveCount(2)
+  })
+})
@@ -0,0 +1,29 @@
+import { describe, expect, it } from 'vitest'
+import { SseParser } from '../../page/sse'
+
+const stream = 'event: delta\r\ndata: {"a":\r\ndata: 1}\r\nid: 7\r\n\r\n: keepalive\n\ndata:no space\n\n'
+
+describe('SseParser', () => {
+  it('parses events split at any position', () => {
+    const expected = [
+      { event: 'delta', data: '{"a":\n1}', id: '7' },
+      { event: 'message', data: 'no space', id: '7' },
+    ]
+    for (let i = 0; i <= stream.length; ++i) {
+      const parser = new SseParser()
+      const events = [...parser.feed(stream.slice(0, i)), ...parser.feed(stream.slice(i))]
+      expect(events, `split at ${i}`).toEqual(expected)
+    }
+  })
+
+  it('ignores events without data', () => {
+    const parser = new SseParser()
+    expect(parser.feed('event: ping\n\nretry: 10\n\n')).toEqual([])
+  })
+
+  it('keeps an incomplete event', () => {
+    const parser = new SseParser()
+    expect(parser.feed('data: x\n')).toEqual([])
+    expect(parser.feed('\n')).toEqual([{ event: 'message', data: 'x', id: '' }])
+  })
+})